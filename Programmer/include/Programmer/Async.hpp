@@ -0,0 +1,237 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __ASYNC_HPP__
+#define __ASYNC_HPP__
+
+#include <chrono>
+#include <vector>
+#include <utility>
+#include <optional>
+#include <exception>
+#include <coroutine>
+#include <functional>
+
+#include <Programmer/Network.hpp>
+
+namespace programmer {
+
+template <typename T>
+class Task;
+
+namespace detail {
+
+struct TaskPromiseBase {
+	std::coroutine_handle<> continuation;
+	std::exception_ptr error;
+
+	// Tasks are lazy, they run when awaited or started
+	std::suspend_always initial_suspend() noexcept { return {}; }
+
+	// Resume the awaiting coroutine
+	struct FinalAwaiter {
+		bool await_ready() noexcept { return false; }
+
+		template <typename P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept {
+			auto continuation = handle.promise().continuation;
+			return continuation ? continuation : std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	FinalAwaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+	std::optional<T> value;
+
+	Task<T> get_return_object() noexcept;
+	void return_value(T v) { value = std::move(v); }
+
+	T result() {
+		if (error)
+			std::rethrow_exception(error);
+		return std::move(*value);
+	}
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+	Task<void> get_return_object() noexcept;
+	void return_void() noexcept {}
+
+	void result() {
+		if (error)
+			std::rethrow_exception(error);
+	}
+};
+
+} // namespace detail
+
+/* Coroutine returning T, resumed by a Reactor. Awaiting a task runs it to completion
+ * and returns its result or rethrows its exception.
+ */
+template <typename T = void>
+class Task {
+	public:
+		typedef detail::TaskPromise<T> promise_type;
+		typedef std::coroutine_handle<promise_type> handle_type;
+
+		explicit Task(handle_type handle) noexcept : _handle(handle) {}
+		Task(Task&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+		Task(const Task&) = delete;
+		Task& operator =(const Task&) = delete;
+
+		~Task() {
+			if (_handle)
+				_handle.destroy();
+		}
+
+		bool await_ready() const noexcept { return false; }
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+			_handle.promise().continuation = awaiting;
+			return _handle;
+		}
+
+		T await_resume() { return _handle.promise().result(); }
+
+		// Run a top level task until its first suspension
+		void start() { _handle.resume(); }
+
+		bool done() const noexcept { return _handle.done(); }
+
+		// Result of a finished top level task
+		T result() { return _handle.promise().result(); }
+
+	private:
+		handle_type _handle;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+	return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+	return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+/* Single threaded event loop resuming tasks waiting for socket readiness or time.
+ * Run one reactor per thread to spread many tasks over a few threads.
+ */
+class Reactor {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		class ReadableAwaiter {
+			public:
+				ReadableAwaiter(Reactor& reactor, SOCKET socket, clock::time_point deadline)
+					: _reactor(reactor), _socket(socket), _deadline(deadline), _ready(false) {}
+
+				bool await_ready() const noexcept { return false; }
+				void await_suspend(std::coroutine_handle<> handle) {
+					_reactor._waiters.push_back({ _socket, _deadline, handle, &_ready, nullptr });
+				}
+
+				// True if the socket is readable, false on timeout
+				bool await_resume() const noexcept { return _ready; }
+
+			private:
+				Reactor& _reactor;
+				const SOCKET _socket;
+				const clock::time_point _deadline;
+				bool _ready;
+		};
+
+		// Signal set from outside of a task, e.g. by a socket watcher
+		struct Event {
+			bool signaled = false;
+		};
+
+		class EventAwaiter {
+			public:
+				EventAwaiter(Reactor& reactor, Event& event, clock::time_point deadline)
+					: _reactor(reactor), _event(event), _deadline(deadline), _ready(false) {}
+
+				bool await_ready() noexcept {
+					_ready = std::exchange(_event.signaled, false);
+					return _ready;
+				}
+
+				void await_suspend(std::coroutine_handle<> handle) {
+					_reactor._waiters.push_back({ INVALID_SOCKET, _deadline, handle, &_ready, &_event });
+				}
+
+				// True if the event was signaled, false on timeout
+				bool await_resume() const noexcept { return _ready; }
+
+			private:
+				Reactor& _reactor;
+				Event& _event;
+				const clock::time_point _deadline;
+				bool _ready;
+		};
+
+		// Suspend until the socket is readable or the deadline passes
+		ReadableAwaiter readable(SOCKET socket, clock::time_point deadline) {
+			return ReadableAwaiter(*this, socket, deadline);
+		}
+
+		// Suspend until the deadline passes
+		ReadableAwaiter sleep_until(clock::time_point deadline) {
+			return ReadableAwaiter(*this, INVALID_SOCKET, deadline);
+		}
+
+		// Suspend until the event is signaled or the deadline passes
+		EventAwaiter wait(Event& event, clock::time_point deadline) {
+			return EventAwaiter(*this, event, deadline);
+		}
+
+		// Signal the event, its waiter is resumed by the next iteration of run()
+		static void notify(Event& event) { event.signaled = true; }
+
+		// Call the handler whenever the socket is readable. Watchers don't keep run() going.
+		void watch(SOCKET socket, std::function<void()> handler);
+		void unwatch(SOCKET socket);
+
+		// Start a task. It is owned by the reactor and runs in run().
+		void spawn(Task<void>&& task);
+
+		// Process events until all spawned tasks finish. Rethrows the first exception of a task.
+		void run();
+
+	private:
+		struct Waiter {
+			SOCKET socket;
+			clock::time_point deadline;
+			std::coroutine_handle<> handle;
+			bool* ready;
+			Event* event;
+		};
+
+		struct Watcher {
+			SOCKET socket;
+			std::function<void()> handler;
+		};
+
+		std::vector<Waiter> _waiters;
+		std::vector<Watcher> _watchers;
+		std::vector<Task<void>> _tasks;
+};
+
+} // namespace programmer
+
+#endif /* __ASYNC_HPP__ */
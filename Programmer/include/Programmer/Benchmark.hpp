@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __BENCHMARK_HPP__
+#define __BENCHMARK_HPP__
+
+#include <cstdint>
+#include <map>
+#include <array>
+#include <vector>
+#include <chrono>
+#include <ostream>
+#include <filesystem>
+
+#include <Programmer/Image.hpp>
+#include <Programmer/DeviceDescriptor.hpp>
+#include <Programmer/Programmer.hpp>
+#include <Programmer/Proxy.hpp>
+#include <Programmer/Target.hpp>
+#include <Programmer/TargetTester.hpp>
+#include <Programmer/protocol.hpp>
+
+namespace programmer {
+
+/* Compression ratio and codec throughput of write payloads of a firmware image */
+class CompressionBenchmark {
+	public:
+		CompressionBenchmark(const Image& image);
+
+		void run();
+
+	private:
+		typedef std::array<std::byte, DeviceDescriptor::WRITE_SIZE> Sector;
+
+		// Measure throughput of a codec function in MB/s
+		template <typename F>
+		double measure(F&& fun, size_t bytes_per_pass);
+
+		// Image split into write sectors, as written by the ImageProgrammer
+		std::map<size_t, Sector> _sectors;
+};
+
+/* Flash time of a firmware image on a simulated target behind the impairment proxy,
+ * for each profile of the matrix
+ */
+class NetworkBenchmark {
+	public:
+		// The target listens on port, the proxy on the next one
+		NetworkBenchmark(const Image& image, uint16_t port = Protocol::PORT + 1);
+
+		void run(uint32_t seed = 1);
+
+	private:
+		typedef std::array<std::byte, DeviceDescriptor::ERASE_SIZE> Page;
+
+		struct Result {
+			bool completed;
+			double seconds;
+			NetworkProgrammer::Statistics programmer;
+			ImpairmentProxy::Statistics proxy;
+			Target::Statistics target;
+			uint32_t wear;	// Most erases of a single page
+		};
+
+		// Program the image through a proxy with the given profile
+		Result measure(const ImpairmentProxy::Profile& profile, uint32_t seed);
+
+		// Image split into erase pages
+		std::map<size_t, Page> _pages;
+		const uint16_t _port;
+};
+
+/* Goodput, loss and round trip time of the network stack test for each payload size and window,
+ * to choose the frame size of the programmer
+ */
+class FrameSizeBenchmark {
+	public:
+		static const std::vector<int> PAYLOAD_SIZES;
+		static const std::vector<size_t> WINDOWS;
+		static constexpr auto WARMUP = std::chrono::seconds(2);
+		static constexpr auto TIME = std::chrono::seconds(5);
+
+		FrameSizeBenchmark(uint32_t address, const TargetNetworkTester::Config& config = TargetNetworkTester::DEFAULT);
+
+		// Measure each combination of the payload sizes and windows, printing a table
+		void run(const std::vector<int>& payload_sizes = PAYLOAD_SIZES, const std::vector<size_t>& windows = WINDOWS,
+				 std::chrono::milliseconds warmup = WARMUP, std::chrono::milliseconds time = TIME);
+
+		// Save the table as JSON if the file has .json extension, CSV otherwise
+		void save(const std::filesystem::path& path) const;
+
+	private:
+		struct Point {
+			int payload_size;
+			size_t window;
+			TargetNetworkTester::Measurement result;
+		};
+
+		void save_csv(std::ostream& out) const;
+		void save_json(std::ostream& out) const;
+
+		const uint32_t _address;
+		const TargetNetworkTester::Config _config;
+		std::vector<Point> _points;
+};
+
+} // namespace programmer
+
+#endif /* __BENCHMARK_HPP__ */
@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __COMPRESSION_HPP__
+#define __COMPRESSION_HPP__
+
+#include <cstdint>
+#include <cstddef>
+#include <span>
+
+namespace programmer {
+
+/* PackBits run-length encoding of write payloads.
+ *
+ * Control byte n followed by:
+ *   0 .. 127:   n + 1 literal bytes
+ *   129 .. 255: one byte repeated 257 - n times
+ *   128:        nothing, ignored
+ * The decoder needs no state besides the output pointer, so it fits the bootloader.
+ */
+class PackBits {
+	public:
+		static constexpr size_t MAX_LITERAL = 128;
+		static constexpr size_t MAX_RUN = 128;
+		static constexpr size_t MIN_RUN = 3;
+
+		// Worst case size of encoded data
+		static constexpr size_t max_encoded_size(size_t size) noexcept {
+			return size + (size + MAX_LITERAL - 1) / MAX_LITERAL;
+		}
+
+		// Encode data. Returns size of encoded data or 0 if it doesn't fit into the output buffer.
+		static size_t encode(std::span<const std::byte> input, std::span<std::byte> output) noexcept;
+
+		// Decode data. Returns size of decoded data or SIZE_MAX if the input is malformed or the output is too small.
+		static size_t decode(std::span<const std::byte> input, std::span<std::byte> output) noexcept;
+};
+
+} // namespace programmer
+
+#endif /* __COMPRESSION_HPP__ */
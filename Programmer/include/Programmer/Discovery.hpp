@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __DISCOVERY_HPP__
+#define __DISCOVERY_HPP__
+
+#include <cstdint>
+#include <chrono>
+#include <array>
+#include <vector>
+
+#include <Programmer/Network.hpp>
+#include <Programmer/protocol.hpp>
+
+namespace programmer {
+
+// Target which answered a discovery
+struct DiscoveredTarget {
+	sockaddr_in address;
+	uint32_t interface_address;	// Local address which received the reply
+	uint16_t device_id;
+	uint16_t version;
+	uint32_t bootloader_address;
+	uint32_t capabilities;		// Capabilities granted to the request, 0 for targets without DiscoverReplyExt
+};
+
+/* Finds all targets reachable from the host in one shot. A directed broadcast is sent
+ * from every local interface at once and all replies received within a window are collected.
+ */
+class Discovery {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		// Local IPv4 interface, addresses in network byte order
+		struct Interface {
+			uint32_t address;
+			uint32_t netmask;
+
+			uint32_t broadcast() const { return address | ~netmask; }
+		};
+
+		static constexpr auto DEFAULT_WINDOW = std::chrono::milliseconds(500);
+		// Unicast probes per second of a sweep
+		static constexpr double DEFAULT_SWEEP_RATE = 1000;
+
+		// All capabilities are requested by default, so targets report everything they support
+		Discovery(uint32_t capabilities = ~0u);
+
+		// Enumerate interfaces which are up, loopback excluded
+		static std::vector<Interface> get_interfaces();
+
+		// Broadcast a discover on all interfaces and collect replies until the window passes
+		std::vector<DiscoveredTarget> discover(clock::duration window = DEFAULT_WINDOW, uint16_t port = Protocol::PORT);
+
+		/* Probe every host of the network with a unicast discover, for networks where broadcasts are filtered.
+		 * Probes are paced to the rate, replies are collected until the window passes after the last one.
+		 * Addresses in network byte order.
+		 */
+		std::vector<DiscoveredTarget> sweep(uint32_t network, uint8_t prefix_length, double rate = DEFAULT_SWEEP_RATE,
+											clock::duration window = DEFAULT_WINDOW, uint16_t port = Protocol::PORT);
+
+		// Parse a network in the CIDR notation, e.g. 10.11.12.0/24
+		static void parse_network(const char* cidr, uint32_t& network, uint8_t& prefix_length);
+
+		static void print(const std::vector<DiscoveredTarget>& targets);
+
+	private:
+		// Number of discover requests sent during the window, replies to each are accepted
+		static constexpr int ATTEMPTS = 2;
+		// Probes a sweep may send back to back
+		static constexpr size_t SWEEP_BURST = 16;
+
+		typedef std::array<std::byte, sizeof(Protocol::RequestHeader) + sizeof(Protocol::Discover)> Request;
+
+		// Build a discover request with a new sequence number
+		const Request& prepare_request();
+
+		// Receive pending replies from the socket. Replies from known targets are skipped.
+		void receive(SocketUDP& socket, uint32_t interface_address, std::vector<DiscoveredTarget>& targets);
+
+		const uint32_t _capabilities;
+		Request _request;
+		uint8_t _seq;
+		uint8_t _sent;	// Requests sent in the current discovery
+};
+
+} // namespace programmer
+
+#endif /* __DISCOVERY_HPP__ */
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __FLASH_HPP__
+#define __FLASH_HPP__
+
+#include <cstdint>
+#include <vector>
+#include <span>
+#include <memory>
+#include <filesystem>
+
+#include <Windows.h>
+
+namespace programmer {
+
+/* Saved flash content, mapped read-only. All boards restored from a snapshot share its pages. */
+class FlashSnapshot {
+	public:
+		FlashSnapshot(const std::filesystem::path& path);
+		~FlashSnapshot();
+
+		FlashSnapshot(const FlashSnapshot&) = delete;
+		FlashSnapshot& operator=(const FlashSnapshot&) = delete;
+
+		size_t size() const { return _size; }
+
+	private:
+		friend class FlashMemory;
+
+		size_t _size;
+		HANDLE _file;
+		HANDLE _mapping;
+};
+
+/* Flash memory of a simulated target, kept in memory or in a file mapped into memory.
+ * The complement of the content is stored, so erased flash reads as zeros. Erased pages
+ * of a sparse file then take neither disk space nor memory, and the file keeps its
+ * content between runs.
+ */
+class FlashMemory {
+	public:
+		// Erased flash in memory
+		FlashMemory(size_t size);
+
+		// Flash in a sparse file, created erased if it doesn't exist
+		FlashMemory(size_t size, const std::filesystem::path& path);
+
+		// Copy-on-write view of a snapshot, written pages become private to this flash
+		FlashMemory(std::shared_ptr<const FlashSnapshot> snapshot);
+
+		~FlashMemory();
+
+		FlashMemory(const FlashMemory&) = delete;
+		FlashMemory& operator=(const FlashMemory&) = delete;
+
+		size_t size() const { return _size; }
+
+		void read(size_t address, std::span<std::byte> data) const;
+		void write(size_t address, std::span<const std::byte> data);
+		void erase(size_t address, size_t size);
+		bool is_blank(size_t address, size_t size) const;
+
+		// Save the content to a file, which can be then loaded by FlashSnapshot
+		void save(const std::filesystem::path& path) const;
+
+	private:
+		// Release the mapping and the file
+		void close();
+
+		const size_t _size;
+		std::vector<std::byte> _memory;		// Storage if there is no file
+		std::byte* _data;
+		HANDLE _file;
+		HANDLE _mapping;
+		std::shared_ptr<const FlashSnapshot> _snapshot;
+};
+
+} // namespace programmer
+
+#endif /* __FLASH_HPP__ */
@@ -14,6 +14,8 @@
 
 namespace programmer {
 
+class Programmer;
+
 class MemoryBlock {
 	public:
 		MemoryBlock(size_t address, const std::span<const std::byte>& data) : address(address), data(data) {};
@@ -47,6 +49,9 @@ class ImageInterface {
 };
 
 class Image : public ImageInterface {
+	public:
+		const std::list<Section>& sections() const { return _sections; }
+
 	protected:
 		virtual void process(size_t address, const std::span<const std::byte>& data);
 		virtual std::span<std::byte> process(size_t address, size_t size);
@@ -57,6 +62,9 @@ class Image : public ImageInterface {
 
 class ImageProgrammer : public Image {
 	public:
+		// Without a programmer, operations are only printed
+		ImageProgrammer(Programmer* programmer = nullptr) : _programmer(programmer) {}
+
 		void program();
 		void erase(size_t address);
 		void write(size_t address, const std::span<std::byte>& data);
@@ -65,6 +73,15 @@ class ImageProgrammer : public Image {
 			READ, WRITE, ERASE, VERIFY
 		};
 		void progress(size_t pos, size_t max, Operation op);
+
+	protected:
+		// Query the target for pages which don't need to be erased
+		void check_blank();
+		bool is_blank(size_t address) const;
+
+		Programmer* const _programmer;
+		size_t _blank_address = 0;
+		std::vector<bool> _blank;
 };
 
 } // namespace programmer
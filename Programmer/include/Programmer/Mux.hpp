@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __MUX_HPP__
+#define __MUX_HPP__
+
+#include <cstdint>
+#include <array>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+#include <Programmer/Network.hpp>
+
+namespace programmer {
+
+class Reactor;
+
+/* Receive buffers shared by all sessions. Buffers are returned to the pool when released,
+ * so memory grows with the number of frames being processed, not with the number of sessions.
+ */
+class BufferPool {
+	public:
+		static constexpr size_t BUFFER_SIZE = 1500;
+		typedef std::array<std::byte, BUFFER_SIZE> Block;
+
+		struct Release {
+			BufferPool* pool;
+			void operator()(Block* block) const noexcept { pool->release(block); }
+		};
+		typedef std::unique_ptr<Block, Release> Buffer;
+
+		BufferPool() : _allocated(0) {}
+
+		Buffer acquire();
+
+		// Number of buffers ever allocated by the pool
+		size_t allocated() const { return _allocated; }
+
+		// Pool used by programmers unless told otherwise
+		static BufferPool& shared();
+
+	private:
+		void release(Block* block) noexcept;
+
+		std::mutex _lock;
+		std::vector<std::unique_ptr<Block>> _free;
+		size_t _allocated;
+};
+
+// Session served by a SessionMux
+class MuxSession {
+	public:
+		virtual ~MuxSession() = default;
+
+		// Frame received from the address of the session. Returns false if the frame was dropped.
+		virtual bool deliver(BufferPool::Buffer&& buffer, size_t size) = 0;
+};
+
+/* One UDP socket serving many sessions. Replies are demultiplexed by their source address
+ * to the sessions, which match them with their requests by the sequence number.
+ * Runs in a single reactor, use one mux per reactor thread.
+ */
+class SessionMux {
+	public:
+		SessionMux(Reactor& reactor, BufferPool& pool = BufferPool::shared());
+		~SessionMux();
+
+		// Route frames from the address to the session
+		void attach(MuxSession* session, const sockaddr_in& address);
+		void detach(MuxSession* session, const sockaddr_in& address);
+
+		void send(std::span<const std::byte> frame, const sockaddr_in& address);
+
+		Reactor& reactor() { return _reactor; }
+
+		struct Statistics {
+			uint64_t rx_frames;
+			uint64_t unknown_source;	// Frames from addresses without a session
+			uint64_t dropped;			// Frames rejected by the session
+		};
+
+		const Statistics& get_statistics() const { return _stats; }
+
+	private:
+		// Receive all pending frames and pass them to the sessions
+		void dispatch();
+
+		static uint64_t key(const sockaddr_in& address) {
+			return (static_cast<uint64_t>(address.sin_addr.s_addr) << 16) | address.sin_port;
+		}
+
+		Reactor& _reactor;
+		BufferPool& _pool;
+		SocketUDP _socket;
+		std::unordered_map<uint64_t, MuxSession*> _sessions;
+		Statistics _stats;
+};
+
+} // namespace programmer
+
+#endif /* __MUX_HPP__ */
@@ -10,14 +10,22 @@
 
 #include <system_error>
 #include <span>
+#include <array>
+#include <chrono>
+#include <climits>
+#include <algorithm>
 
 #include <Winsock2.h> 
 #include <Ws2tcpip.h>
+#include <mstcpip.h>
 
 #include <Programmer/types.hpp>
 
 namespace programmer {
 
+// Ethernet hardware address
+typedef std::array<uint8_t, 6> MacAddress;
+
 class SocketException : public std::system_error {
 	public:
 		SocketException(const char*) : std::system_error(WSAGetLastError(), std::system_category()) {}
@@ -118,6 +126,41 @@ class SocketUDP : public Socket {
 			setsockopt(IPPROTO_IP, IP_RECEIVE_BROADCAST, &opt, sizeof(opt));
 		}
 
+		// Allows the socket to be bound to an address that is already in use.
+		void set_reuse_address(bool reuse) {
+			BOOL opt = reuse;
+			setsockopt(SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+		}
+
+		// Joins a multicast group on the default interface.
+		void join_group(uint32_t group_address) {
+			ip_mreq mreq = {};
+			mreq.imr_multiaddr.s_addr = group_address;
+			mreq.imr_interface.s_addr = INADDR_ANY;
+			setsockopt(IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+		}
+
+		// Selects the interface used for outgoing multicast packets.
+		void set_multicast_interface(uint32_t interface_address) {
+			in_addr addr = {};
+			addr.s_addr = interface_address;
+			setsockopt(IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr));
+		}
+
+		// Sets time to live of outgoing multicast packets.
+		void set_multicast_ttl(DWORD ttl) {
+			setsockopt(IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+		}
+
+		// Controls if an ICMP port unreachable fails the next recvfrom with WSAECONNRESET.
+		void report_unreachable(bool report) {
+			BOOL opt = report;
+			DWORD returned = 0;
+			int ret = ::WSAIoctl(_handle, SIO_UDP_CONNRESET, &opt, sizeof(opt), nullptr, 0, &returned, nullptr, nullptr);
+			if (ret == SOCKET_ERROR)
+				throw SocketException("WSAIoctl");
+		}
+
 		void bind(const sockaddr_in* addr) {
 			Socket::bind(addr, sizeof(*addr));
 		}
@@ -142,9 +185,29 @@ class Network {
 			return ret;
 		}
 
+		// Longest time a server loop waits before checking if it should stop
+		static constexpr int POLL_INTERVAL_MS = 100;
+
+		/* Poll until the deadline, time_point::max() waits without one.
+		 * Returns at the latest after max_timeout milliseconds if it is not negative.
+		 */
+		static int poll(std::span<struct pollfd> fds, std::chrono::steady_clock::time_point deadline, int max_timeout = -1) {
+			int timeout = max_timeout;
+			if (deadline != std::chrono::steady_clock::time_point::max()) {
+				const auto wait = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+				const long long limit = (max_timeout < 0) ? INT_MAX : max_timeout;
+				timeout = static_cast<int>(std::clamp<long long>(wait.count(), 0, limit));
+			}
+
+			return poll(fds, timeout);
+		}
+
 		static void startup();
 		static void cleanup();
 
+		// Parse a MAC address in the 01:23:45:67:89:AB notation
+		static bool parse_mac(const char* text, MacAddress& mac);
+
 		template <typename T>
 		static constexpr T big_endian(T val) noexcept {
 			if constexpr (std::endian::native == std::endian::little)
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __PACER_HPP__
+#define __PACER_HPP__
+
+#include <cstdint>
+#include <chrono>
+
+namespace programmer {
+
+/* Token bucket pacing transmissions to a target with a small receive buffer.
+ * The rate grows while frames are delivered and is cut on a loss or when the target
+ * reports its buffer filling up. A burst never exceeds the free space in that buffer.
+ */
+class Pacer {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		// Rates in bytes per second, buffer_size is the target's receive buffer in bytes
+		Pacer(double initial_rate, double min_rate, double max_rate, size_t buffer_size);
+
+		// Check if a frame can be sent now
+		bool ready();
+
+		// Time when the next frame can be sent
+		clock::time_point next() const;
+
+		// Wait until a frame can be sent
+		void wait();
+
+		// Account a sent frame. The bucket may go into debt, a large frame only delays the next one.
+		void sent(size_t size);
+
+		// Capacity of the target's receive buffer changed
+		void set_buffer_size(size_t buffer_size);
+
+		// Frame was delivered after the given round trip time
+		void delivered(clock::duration rtt);
+
+		// Seed the round trip time, e.g. with one measured by a previous session
+		void set_rtt(clock::duration rtt);
+
+		// Frame was lost
+		void lost();
+
+		// Target reported number of bytes waiting in its receive buffer
+		void occupancy(size_t used);
+
+		// Retransmission timeout derived from the measured round trip time
+		clock::duration timeout(clock::duration max) const;
+
+		double rate() const { return _rate; }
+		clock::duration rtt() const { return _srtt; }
+
+	private:
+		// Rate multiplier for each delivered frame
+		static constexpr double INCREASE = 1.0 + 1.0 / 16;
+		// Rate multiplier after a loss
+		static constexpr double DECREASE = 0.5;
+		// Rate multiplier when the target's buffer is more than half full
+		static constexpr double BACKOFF = 7.0 / 8;
+		// Lower bound of the retransmission timeout
+		static constexpr auto MIN_TIMEOUT = std::chrono::milliseconds(20);
+
+		void refill(clock::time_point now);
+
+		double _rate;
+		const double _min_rate;
+		const double _max_rate;
+		double _buffer_size;
+		double _burst;	// Capacity of the bucket
+		double _tokens;
+		clock::time_point _last;
+		clock::duration _srtt;
+		clock::duration _rttvar;
+		bool _rtt_valid;
+};
+
+} // namespace programmer
+
+#endif /* __PACER_HPP__ */
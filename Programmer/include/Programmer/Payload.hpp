@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __PAYLOAD_HPP__
+#define __PAYLOAD_HPP__
+
+#include <cstdint>
+#include <cstddef>
+#include <span>
+
+namespace programmer {
+
+/* Payload of the network stack test.
+ *
+ * Each 8 bytes of a request are a counter based random number of the session key, sequence number
+ * and position, so the receiver recomputes them instead of keeping a copy. The target echoes each
+ * byte XORed with all the previous ones and the initial mask. Both are computed a word at a time.
+ */
+class TestPayload {
+	public:
+		// Initial mask of the echo
+		static constexpr uint8_t MASK = 0x5A;
+
+		// Random number of the counter, independent for different keys
+		static uint64_t random(uint64_t key, uint64_t counter) noexcept;
+
+		// Fill the request payload of a frame
+		static void generate(uint64_t key, uint32_t seq, std::span<std::byte> payload) noexcept;
+
+		// Echo of the payload computed by the target. Input and output may be the same buffer.
+		static void echo(std::span<const std::byte> payload, std::span<std::byte> output) noexcept;
+
+		// Check the echo of the payload generated for a frame
+		static bool verify(uint64_t key, uint32_t seq, std::span<const std::byte> echo) noexcept;
+
+	private:
+		// Byte i of the result is XOR of bytes 0 .. i of the word and the carried mask
+		static uint64_t scan(uint64_t word, uint8_t& mask) noexcept;
+};
+
+} // namespace programmer
+
+#endif /* __PAYLOAD_HPP__ */
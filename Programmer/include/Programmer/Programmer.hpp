@@ -11,10 +11,16 @@
 #include <cstdint>
 #include <span>
 #include <array>
+#include <vector>
+#include <deque>
+#include <memory>
 #include <concepts>
 #include <utility>
 
 #include <Programmer/Network.hpp>
+#include <Programmer/Pacer.hpp>
+#include <Programmer/Async.hpp>
+#include <Programmer/Mux.hpp>
 #include <Programmer/protocol.hpp>
 #include <Programmer/DeviceDescriptor.hpp>
 
@@ -54,12 +60,27 @@ class IProgrammerStrategy {
 		// Calculate a checksum of a device's memory
 		virtual uint32_t checksum(uint32_t address, size_t size);
 
+		// Calculate a checksum of each erase page in a range
+		virtual std::vector<uint32_t> checksum_pages(uint32_t address, size_t pages);
+
+		// Check which erase pages in a range are blank
+		virtual std::vector<bool> blank_check(uint32_t address, size_t pages);
+
 		// Erase whole device memory
 		virtual void chip_erase();
 
 		// Erase sector and write it
 		virtual void erase_write(uint32_t address, const std::span<const std::byte>& buffer);
 
+		// Queue erase of a device's memory. May be deferred until flush().
+		virtual void queue_erase(uint32_t address);
+
+		// Queue write of a device's memory. May be deferred until flush().
+		virtual void queue_write(uint32_t address, const std::span<const std::byte>& buffer);
+
+		// Execute queued operations
+		virtual void flush();
+
 		constexpr const DeviceDescriptor* device_descriptor() const { return _dev_desc; }
 
 		constexpr const ProgrammerDescriptor* programmer_descriptor() const { return _prog_desc; }
@@ -100,6 +121,21 @@ public:
 	// Calculate a checksum of a device's memory
 	uint32_t checksum(uint32_t address, size_t size);
 
+	// Calculate a checksum of each erase page in a range
+	std::vector<uint32_t> checksum_pages(uint32_t address, size_t pages);
+
+	// Check which erase pages in a range are blank
+	std::vector<bool> blank_check(uint32_t address, size_t pages);
+
+	// Queue erase of a device's memory. May be deferred until flush().
+	void queue_erase(uint32_t address);
+
+	// Queue write of a device's memory. May be deferred until flush().
+	void queue_write(uint32_t address, const std::span<const std::byte>& buffer);
+
+	// Execute queued operations
+	void flush();
+
 protected:
 	const DeviceDescriptor* device_descriptor() const {
 		return _programmer->device_descriptor();
@@ -110,10 +146,14 @@ protected:
 	std::unique_ptr<IProgrammerStrategy> _programmer;
 };
 
-class NetworkProgrammer : public IProgrammerStrategy {
+class NetworkProgrammer : public IProgrammerStrategy, private MuxSession {
 	public:
 		NetworkProgrammer();
 
+		// Programmer sharing the socket of the mux. Supports only asynchronous operations with a unicast address.
+		NetworkProgrammer(SessionMux& mux);
+		~NetworkProgrammer();
+
 		// Discover device on network
 		void discover_device(uint16_t port = Protocol::PORT);
 
@@ -138,18 +178,109 @@ class NetworkProgrammer : public IProgrammerStrategy {
 		// Calculate a checksum of a device's memory
 		virtual uint32_t checksum(uint32_t address, size_t size);
 
+		// Calculate a checksum of each erase page in a range
+		virtual std::vector<uint32_t> checksum_pages(uint32_t address, size_t pages);
+
+		// Check which erase pages in a range are blank
+		virtual std::vector<bool> blank_check(uint32_t address, size_t pages);
+
+		// Erase sector and write it
+		virtual void erase_write(uint32_t address, const std::span<const std::byte>& buffer);
+
+		// Erase whole device memory
+		virtual void chip_erase();
+
+		// Queue erase of a device's memory. Packed into a compound request when supported.
+		virtual void queue_erase(uint32_t address);
+
+		// Queue write of a device's memory. Packed into a compound request when supported.
+		virtual void queue_write(uint32_t address, const std::span<const std::byte>& buffer);
+
+		// Send pending compound request
+		virtual void flush();
+
+		// Check which erase pages in a range were completely received from a stream session
+		std::vector<bool> stream_status(uint32_t address, size_t pages, uint16_t session);
+
+		/* Awaitable versions of the operations, resumed by the reactor when a reply arrives.
+		 * Only one operation of a programmer can be in progress at a time.
+		 */
+		Task<> connect_device_async(Reactor& reactor, uint32_t ip_address, uint16_t port = Protocol::PORT);
+		Task<std::span<const std::byte>> read_async(Reactor& reactor, uint32_t address, size_t size);
+		Task<> write_async(Reactor& reactor, uint32_t address, std::span<const std::byte> buffer);
+		Task<> erase_async(Reactor& reactor, uint32_t address);
+		Task<uint32_t> checksum_async(Reactor& reactor, uint32_t address, size_t size);
+		Task<> flush_async(Reactor& reactor);
+
 		struct BootloaderInfo {
 			uint16_t device_id;
 			uint16_t version;
 			uint32_t address;
 		};
 
-		const BootloaderInfo& get_bootloader_info() {
+		const BootloaderInfo& get_bootloader_info() const {
 			return _bootloader;
 		}
 
+		// Features and limits of a target negotiated during discovery
+		struct SessionProfile {
+			uint32_t capabilities;	// Protocol::Capability
+			uint16_t max_request;	// Largest request frame
+			uint16_t max_reply;		// Largest reply frame
+			uint8_t window;			// Number of requests the target can buffer
+			Protocol::ChecksumAlgorithm checksum;
+
+			constexpr bool supports(uint32_t caps) const noexcept { return (capabilities & caps) == caps; }
+		};
+
+		const SessionProfile& get_session_profile() const {
+			return _profile;
+		}
+
+		// Select capabilities requested during discovery
+		void set_capabilities(uint32_t capabilities) { _capabilities = capabilities; }
+
+		struct Statistics {
+			uint64_t tx_frames;
+			uint64_t rx_frames;
+			uint64_t tx_bytes;
+			uint64_t rx_bytes;
+			uint64_t retransmissions;
+			uint64_t write_bytes;			// Data written to the target
+			uint64_t write_payload_bytes;	// Write payload sent, smaller than write_bytes when packed
+		};
+
+		const Statistics& get_statistics() const { return _stats; }
+		void clear_statistics() { _stats = {}; }
+
+		// Largest packed sector worth decoding by the target, a quarter of the sector must be saved
+		static constexpr size_t MAX_PACKED_SIZE = sizeof(Protocol::Write::data) * 3 / 4;
+
+		// Smoothed round trip time to the target, zero until measured
+		std::chrono::steady_clock::duration get_rtt() const { return _pacer.rtt(); }
+
+		// Start with a round trip time known from a previous session, so a lost first request is retransmitted early
+		void set_rtt(std::chrono::steady_clock::duration rtt) { _pacer.set_rtt(rtt); }
+
 	private:
+		// Time to wait for any reply before retransmission
 		static constexpr long long TIMEOUT = 1000;
+		// Time to wait for a final status after target reported STATUS_INPROGRESS
+		static constexpr long long BUSY_TIMEOUT = 5000;
+		// Number of transmissions of a request
+		static constexpr int ATTEMPTS = 3;
+		// Pacing of requests in bytes per second
+		static constexpr double MIN_RATE = 8 * 1024;
+		static constexpr double INITIAL_RATE = 128 * 1024;
+		static constexpr double MAX_RATE = 12.5 * 1000 * 1000;
+		// Capabilities supported by this implementation
+		static constexpr uint32_t HOST_CAPABILITIES = Protocol::CAP_QUIET_ACK | Protocol::CAP_COMPOUND |
+			Protocol::CAP_CHECKSUM | Protocol::CAP_CHECKSUM_PAGES | Protocol::CAP_BLANK_CHECK |
+			Protocol::CAP_ERASE_WRITE | Protocol::CAP_CHIP_ERASE | Protocol::CAP_PACKED_WRITE |
+			Protocol::CAP_STREAM;
+		// Operations of the original protocol, assumed for targets without DiscoverReplyExt
+		static constexpr uint32_t LEGACY_CAPABILITIES = Protocol::CAP_CHECKSUM | Protocol::CAP_ERASE_WRITE |
+			Protocol::CAP_CHIP_ERASE;
 
 		enum class Result {
 			Ignore, ExtendTime, Done
@@ -160,21 +291,69 @@ class NetworkProgrammer : public IProgrammerStrategy {
 
 		void check_connection();
 
+		// Copy write data into a sector, padding it with erased bytes
+		static std::array<std::byte, sizeof(Protocol::Write::data)> sector(std::span<const std::byte> buffer);
+
+		// Encode write data if the target supports it and it pays off. Returns size of packed data or 0.
+		size_t pack(std::span<const std::byte> data, std::span<std::byte> output) const;
+
+		void count_write(size_t size, size_t payload_size);
+
+		// Append an operation to the pending compound request, sending it first if it is full
+		Protocol::RequestHeader* queue_operation(Protocol::Operation op, uint32_t address, size_t payload_size);
+
 		// Send frame and wait for reply
 		void communicate();
 
+		// Send frame and wait for reply without blocking the reactor
+		Task<> communicate_async(Reactor& reactor);
+
+		// Send the prepared frame. Returns time to wait for a reply.
+		std::chrono::steady_clock::duration transmit(int attempt);
+
+		// Process received frame, measure round trip time and extend the deadline of a busy target
+		Result receive(int attempt, std::chrono::steady_clock::time_point sent, bool& replied,
+					   std::chrono::steady_clock::time_point& deadline);
+
+		// Prepare a write request
+		void prepare_write(uint32_t address, std::span<const std::byte> buffer);
+
+		// Check statuses of a compound reply
+		void check_compound(const std::vector<uint32_t>& queued);
+
 		void set_address(uint32_t address, uint16_t port);
 
 		// Process DiscoverReply from target
 		void process_discover(Protocol::Operation op = Protocol::OP_DISCOVER);
 
-		SocketUDP _socket;
+		// Store target information from a received DiscoverReply
+		void discovered(Protocol::Operation op);
+
+		// Build session profile from DiscoverReply
+		void parse_profile(Protocol::Operation op);
+
+		// Frame received by the mux
+		virtual bool deliver(BufferPool::Buffer&& buffer, size_t size);
+
+		// Maximum number of received frames waiting for processing
+		static constexpr size_t MAX_PENDING = 4;
+
+		SessionMux* const _mux;
+		std::unique_ptr<SocketUDP> _socket;	// Own socket, unless a mux is used
 		std::array<struct pollfd, 1> _poll;
+		std::deque<std::pair<BufferPool::Buffer, size_t>> _pending;
+		Reactor::Event _received;
 		struct sockaddr_in _tx_address;
 		struct sockaddr_in _rx_address;
 		BootloaderInfo _bootloader;
+		SessionProfile _profile;
+		uint32_t _capabilities;
+		Statistics _stats;
+		ProgrammerDescriptor _descriptor;
+		Pacer _pacer;
 
-		static const ProgrammerDescriptor _prog_desc;
+		// Addresses of operations in the pending compound request, to report failures
+		std::vector<uint32_t> _queued;
 
 		class TransmitBuffer {
 			public:
@@ -184,11 +363,11 @@ class NetworkProgrammer : public IProgrammerStrategy {
 					requires requires(T v) {
 					T::Operation;
 				}
-				T* prepare_payload() {
+				T* prepare_payload(uint32_t address = 0, uint16_t length = 0) {
 					constexpr auto size = sizeof(Protocol::RequestHeader) + sizeof(T);
 					static_assert(std::tuple_size<decltype(_buffer)>::value >= size, "Tx buffer too small");
 			
-					get_header()->operation = T::Operation;
+					select_operation(static_cast<Protocol::Operation>(T::Operation), address, length);
 					_size = size;
 					return reinterpret_cast<T*>(&_buffer[sizeof(Protocol::RequestHeader)]);
 				}
@@ -196,6 +375,15 @@ class NetworkProgrammer : public IProgrammerStrategy {
 				// Select operation without payload
 				void select_operation(Protocol::Operation op, uint32_t address = 0, uint16_t length = 0);
 
+				// Select operation with a payload of given size
+				std::span<std::byte> prepare_payload(Protocol::Operation op, size_t size, uint32_t address = 0, uint16_t length = 0);
+
+				// Start an empty compound request
+				void begin_compound();
+
+				// Append an operation to the compound request. Returns nullptr if the request would exceed the limit.
+				Protocol::RequestHeader* append(Protocol::Operation op, uint32_t address, size_t payload_size, size_t limit);
+
 				uint8_t get_operation() const { return get_header()->operation; }
 				uint8_t get_sequence() const { return get_header()->seq; }
 
@@ -207,7 +395,7 @@ class NetworkProgrammer : public IProgrammerStrategy {
 				const Protocol::RequestHeader* get_header() const;
 
 				size_t _size;
-				std::array<std::byte, 128> _buffer;
+				std::array<std::byte, Protocol::MAX_FRAME> _buffer;
 		} _tx_buf;
 
 		class ReceiveBuffer {
@@ -220,7 +408,7 @@ class NetworkProgrammer : public IProgrammerStrategy {
 				if (get_operation() != op)
 					throw Exception("The buffer contains another data type.");
 
-				return reinterpret_cast<T*>(&_buffer[sizeof(Protocol::ReplyHeader)]);
+				return reinterpret_cast<T*>(&(*_buffer)[sizeof(Protocol::ReplyHeader)]);
 			}
 
 			const std::span<const std::byte> get_payload(Protocol::Operation op) {
@@ -232,7 +420,7 @@ class NetworkProgrammer : public IProgrammerStrategy {
 				if (get_operation() != op)
 					throw Exception("The buffer contains another data type.");
 				
-				return std::span<const std::byte>(_buffer.data() + header_size, _size - header_size);
+				return std::span<const std::byte>(_buffer->data() + header_size, _size - header_size);
 			}
 
 			uint8_t get_operation() const { return get_header()->operation; }
@@ -242,19 +430,25 @@ class NetworkProgrammer : public IProgrammerStrategy {
 			}
 			uint8_t get_version() const { return get_header()->version; }
 
-			// Get span of the buffer
-			operator std::span<std::byte>() { return std::span(_buffer); };
+			// Get span of an empty buffer from the pool
+			std::span<std::byte> acquire();
+
+			// Take a buffer with a received frame
+			void assign(BufferPool::Buffer&& buffer, size_t size);
+
+			// Return the buffer to the pool. Invalidates the received payload.
+			void release();
 
 			// Set length of a data in the buffer
 			void set_content_length(size_t size);
 
-			static constexpr size_t BUFFER_SIZE = 1500; // TODO: To nie jest prawda. Musisz uwzgldni jeszcze nagwek IP i UDP
+			static constexpr size_t BUFFER_SIZE = BufferPool::BUFFER_SIZE; // TODO: To nie jest prawda. Musisz uwzgldni jeszcze nagwek IP i UDP
 			static constexpr size_t MAX_PAYLOAD = BUFFER_SIZE - sizeof(Protocol::ReplyHeader);
 		private:
 			const Protocol::ReplyHeader* get_header() const;
 
-			size_t _size;
-			std::array<std::byte, BUFFER_SIZE> _buffer;
+			size_t _size = 0;
+			BufferPool::Buffer _buffer{ nullptr, { &BufferPool::shared() } };
 		} _rx_buf;
 };
 
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __PROVISION_HPP__
+#define __PROVISION_HPP__
+
+#include <cstdint>
+#include <chrono>
+#include <vector>
+
+#include <Programmer/Network.hpp>
+#include <Programmer/Discovery.hpp>
+#include <Programmer/protocol.hpp>
+
+namespace programmer {
+
+/* Network configuration of many factory-fresh boards at once. Each board gets an address
+ * from a pool in an OP_NET_CONFIG broadcast addressed to its MAC. All requests of a round are
+ * sent back to back and matched with their replies by the sequence number, boards which
+ * didn't confirm the assignment are retried in the next round.
+ */
+class Provisioner {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		struct Assignment {
+			MacAddress mac;
+			uint32_t ip_address;		// Assigned address, network byte order
+			bool confirmed;
+			DiscoveredTarget target;	// Reply of the board, valid if confirmed
+		};
+
+		// Time to wait for replies after the last request of a round
+		static constexpr auto DEFAULT_WINDOW = std::chrono::milliseconds(500);
+		// Requests per second
+		static constexpr double DEFAULT_RATE = 500;
+
+		// Addresses are assigned consecutively from the pool between first_address and last_address, in network byte order
+		Provisioner(uint32_t first_address, uint32_t last_address, uint32_t capabilities = ~0u);
+
+		// Add a board to the batch and assign it the next address from the pool
+		void add_board(const MacAddress& mac);
+
+		// Configure all boards which haven't confirmed their assignment yet. Returns number of confirmed boards.
+		size_t provision(uint16_t port = Protocol::PORT, clock::duration window = DEFAULT_WINDOW, double rate = DEFAULT_RATE);
+
+		const std::vector<Assignment>& get_assignments() const { return _assignments; }
+
+		// Replies which didn't come from the address of their assignment
+		size_t get_errors() const { return _errors; }
+
+		void print() const;
+
+	private:
+		// Number of rounds of a provisioning
+		static constexpr int ATTEMPTS = 3;
+		// Boards configured in one round, each request of the round has a distinct sequence number
+		static constexpr size_t MAX_BATCH = 128;
+		static constexpr size_t BURST = 8;
+
+		typedef std::array<std::byte, sizeof(Protocol::RequestHeader) + sizeof(Protocol::NetworkConfig)> Request;
+
+		// Send configuration to each board of the batch and collect replies until the window passes
+		void round(SocketUDP& socket, const std::vector<Assignment*>& batch, uint16_t port,
+				   clock::duration window, double rate);
+
+		// Receive pending replies, confirming the matching assignments
+		void receive(SocketUDP& socket, const std::vector<Assignment*>& batch, uint8_t first_seq);
+
+		void prepare_request(Request& request, const Assignment& assignment, uint8_t seq) const;
+
+		const uint32_t _capabilities;
+		uint32_t _next_address;		// Host byte order
+		const uint32_t _last_address;
+		uint8_t _seq;
+		size_t _errors;
+		std::vector<Assignment> _assignments;
+};
+
+} // namespace programmer
+
+#endif /* __PROVISION_HPP__ */
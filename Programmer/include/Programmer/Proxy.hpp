@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __PROXY_HPP__
+#define __PROXY_HPP__
+
+#include <cstdint>
+#include <chrono>
+#include <queue>
+#include <vector>
+#include <atomic>
+#include <random>
+
+#include <Programmer/Network.hpp>
+
+namespace programmer {
+
+/* UDP proxy between a programmer and a target, impairing the traffic in both directions
+ * like a lossy network. All random decisions come from a seeded generator, so a run
+ * with the same seed and the same traffic is reproducible.
+ */
+class ImpairmentProxy {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		struct Profile {
+			const char* name;
+			double loss;						// Probability of dropping a datagram
+			std::chrono::microseconds latency;	// One way delay
+			std::chrono::microseconds jitter;	// Delay varies uniformly by up to this
+			double reorder;						// Probability of sending a datagram without the delay, overtaking earlier ones
+			double duplicate;					// Probability of delivering a datagram twice
+			double bandwidth;					// Bytes per second in each direction, 0 is unlimited
+		};
+
+		// Profiles of the benchmark matrix
+		static const std::vector<Profile> PROFILES;
+
+		// The programmer sends to listen_port, datagrams are forwarded to the target
+		ImpairmentProxy(uint16_t listen_port, uint32_t target_address, uint16_t target_port,
+						const Profile& profile, uint32_t seed = 1);
+
+		// Forward datagrams until stop()
+		void run();
+		void stop() { _running = false; }
+
+		struct Statistics {
+			uint64_t forwarded;
+			uint64_t dropped;
+			uint64_t duplicated;
+			uint64_t reordered;
+		};
+
+		const Statistics& get_statistics() const { return _stats; }
+
+	private:
+		struct Datagram {
+			clock::time_point time;
+			uint64_t order;		// Keeps datagrams due at the same time in order
+			bool upstream;		// From the programmer to the target
+			std::vector<std::byte> data;
+
+			bool operator >(const Datagram& other) const {
+				return (time != other.time) ? (time > other.time) : (order > other.order);
+			}
+		};
+
+		// Receive all pending datagrams from the socket and schedule them
+		void receive(SocketUDP& socket, bool upstream);
+
+		// Apply the profile to a datagram and queue it for sending
+		void schedule(std::vector<std::byte>&& data, bool upstream);
+
+		// Send datagrams which are due. Returns time of the next one.
+		clock::time_point send();
+
+		const Profile _profile;
+		SocketUDP _client_socket;
+		SocketUDP _target_socket;
+		sockaddr_in _client;		// Last programmer which sent a datagram
+		sockaddr_in _target;
+		bool _client_known;
+		clock::time_point _link_free[2];	// When each direction finishes sending queued data, indexed by upstream
+
+		std::mt19937 _rng;
+		std::priority_queue<Datagram, std::vector<Datagram>, std::greater<Datagram>> _queue;
+		uint64_t _order;
+		std::atomic<bool> _running;
+		Statistics _stats;
+};
+
+} // namespace programmer
+
+#endif /* __PROXY_HPP__ */
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __RESPONDER_HPP__
+#define __RESPONDER_HPP__
+
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <random>
+
+#include <Programmer/Network.hpp>
+#include <Programmer/TargetTester.hpp>
+#include <Programmer/protocol.hpp>
+
+namespace programmer {
+
+/* Simulated firmware of the network stack test, answering TargetNetworkTester without a board.
+ * Requests wait in a receive ring like in the Ethernet controller and are handled one at a time.
+ * A request arriving to a full ring is dropped, the response echoes the payload masked the same
+ * way as the tester expects it.
+ * Like the rest of the project it is built on the Winsock sockets of Network, so it runs on Windows
+ * only. The tester and the responder can share a machine without a board over the loopback.
+ */
+class TargetNetworkResponder {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		struct Config {
+			uint16_t rx_buffer_size;	// Receive ring of the Ethernet controller
+			uint16_t tx_buffer_size;	// Transmit buffer, longer responses are truncated
+			uint32_t frame_time_us;		// Time to handle a request and transmit its response
+			double rx_loss;				// Probability of losing a request before the ring
+			double tx_loss;				// Probability of losing a response
+			uint32_t reboot_interval;	// Reboot after this number of responses, 0 never
+		};
+
+		// Ethernet controller with 8 kB of memory, the transmit buffer taken from its end
+		static constexpr Config DEFAULT = { 8192 - TARGET_BUFFER_SIZE, TARGET_BUFFER_SIZE, 500, 0, 0, 0 };
+		// Answering at once with a large ring, to measure the tester itself
+		static constexpr Config LINE_RATE = { UINT16_MAX & ~1, TARGET_BUFFER_SIZE, 0, 0, 0, 0 };
+
+		TargetNetworkResponder(const Config& config = DEFAULT, uint16_t port = Protocol::PORT, uint32_t seed = 1);
+
+		// Answer requests until stop()
+		void start();
+		void stop() { _running = false; }
+
+		// Start over like after a watchdog reset. Waiting requests are lost and the boot counter increments.
+		void reboot();
+
+		struct Statistics {
+			uint64_t rx_frames;
+			uint64_t tx_frames;
+			uint64_t overflows;		// Requests dropped by a full receive ring
+			uint64_t lost;			// Requests and responses lost on purpose
+		};
+
+		const Statistics& get_statistics() const { return _stats; }
+
+	private:
+		typedef TargetNetworkTester::Request Request;
+		typedef TargetNetworkTester::Response Response;
+
+		// Receive status vector + eth + ip + udp + frame check sequence, stored in the ring with each frame
+		static constexpr uint16_t RX_OVERHEAD = 6 + 14 + 20 + 8 + 4;
+		// RCON reported in the first response after a boot, the flags are active low
+		static constexpr uint8_t RCON_RUNNING = 0x3F;
+		static constexpr uint8_t RCON_WATCHDOG = 0x37;
+		static constexpr uint8_t RCON_POWER_ON = 0x3C;
+		// ESTAT with the PHY clock ready
+		static constexpr uint8_t ESTAT_READY = 0x01;
+
+		struct Pending {
+			clock::time_point arrival;
+			sockaddr_in address;
+			uint16_t ring_size;		// Space taken in the receive ring
+			std::vector<std::byte> data;
+		};
+
+		// Receive all waiting requests into the ring
+		void receive();
+
+		// Handle the oldest request of the ring
+		void respond();
+
+		// Handle requests whose processing time passed. Returns time when the next one finishes.
+		clock::time_point process();
+
+		bool chance(double probability);
+
+		const Config _config;
+		SocketUDP _socket;
+		std::minstd_rand _rng;
+		std::atomic<bool> _running;
+
+		std::deque<Pending> _rx_queue;
+		uint16_t _rx_used;
+		uint16_t _rx_read;		// ERXRDPT
+		uint16_t _rx_write;		// ERXWRPT
+		clock::time_point _busy_until;	// End of the last handled request
+
+		uint32_t _last_seq;
+		uint32_t _boot_counter;
+		uint32_t _received_udp;
+		uint32_t _responses;	// Since the last boot
+		uint8_t _rcon;
+		Statistics _stats;
+		std::array<std::byte, Protocol::MAX_FRAME> _buffer;
+};
+
+} // namespace programmer
+
+#endif /* __RESPONDER_HPP__ */
@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __RING_HPP__
+#define __RING_HPP__
+
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <new>
+
+namespace programmer {
+
+/* Lock-free ring passing items from one producer thread to one consumer thread.
+ * Slots are preallocated, the producer fills a slot in place and publishes it,
+ * the consumer reads it in place and releases it.
+ */
+template <typename T, size_t N>
+class SpscRing {
+	static_assert(N && !(N & (N - 1)), "Size of the ring must be a power of two");
+
+	public:
+		SpscRing() : _head(0), _tail(0) {}
+
+		SpscRing(const SpscRing&) = delete;
+		SpscRing& operator=(const SpscRing&) = delete;
+
+		static constexpr size_t capacity() { return N; }
+
+		// Producer: free slot to fill, nullptr if the ring is full
+		T* claim() {
+			const size_t head = _head.load(std::memory_order_relaxed);
+			if (head - _tail.load(std::memory_order_acquire) == N)
+				return nullptr;
+
+			return &_slots[head & (N - 1)];
+		}
+
+		// Producer: pass the claimed slot to the consumer
+		void publish() {
+			_head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		// Producer: wait until the consumer releases slots, so less than count are in use
+		void wait_below(size_t count) const {
+			const size_t head = _head.load(std::memory_order_relaxed);
+			for (size_t tail = _tail.load(std::memory_order_acquire); head - tail >= count;
+				 tail = _tail.load(std::memory_order_acquire))
+				_tail.wait(tail, std::memory_order_acquire);
+		}
+
+		// Consumer: oldest published slot, nullptr if the ring is empty
+		T* front() {
+			const size_t tail = _tail.load(std::memory_order_relaxed);
+			if (tail == _head.load(std::memory_order_acquire))
+				return nullptr;
+
+			return &_slots[tail & (N - 1)];
+		}
+
+		// Consumer: return the oldest slot to the producer
+		void pop() {
+			_tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+			_tail.notify_one();
+		}
+
+		// Consumer: release all published slots
+		void clear() {
+			_tail.store(_head.load(std::memory_order_acquire), std::memory_order_release);
+			_tail.notify_one();
+		}
+
+		// Slots in use, exact in the producer and the consumer thread
+		size_t size() const {
+			const size_t tail = _tail.load(std::memory_order_acquire);
+			return _head.load(std::memory_order_acquire) - tail;
+		}
+
+	private:
+		// Indexes grow without wrapping, each written by one side only and kept on own cache line
+		alignas(std::hardware_destructive_interference_size) std::atomic<size_t> _head;
+		alignas(std::hardware_destructive_interference_size) std::atomic<size_t> _tail;
+		std::array<T, N> _slots;
+};
+
+} // namespace programmer
+
+#endif /* __RING_HPP__ */
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __STREAM_HPP__
+#define __STREAM_HPP__
+
+#include <cstdint>
+#include <chrono>
+#include <map>
+#include <array>
+#include <vector>
+
+#include <Programmer/Image.hpp>
+#include <Programmer/Network.hpp>
+#include <Programmer/Programmer.hpp>
+#include <Programmer/DeviceDescriptor.hpp>
+
+namespace programmer {
+
+/* One-to-many programming of identical boards. The image is sent once to a multicast
+ * or broadcast group, each target reports pages it received completely and only
+ * the missing pages are written to it over unicast.
+ */
+class StreamProgrammer {
+	public:
+		// Multicast is sent from the given interface, the default one if INADDR_ANY
+		StreamProgrammer(const Image& image, uint32_t interface_address = INADDR_ANY);
+
+		// Add a connected target. Targets without CAP_STREAM are programmed over unicast only.
+		void add_target(NetworkProgrammer* target);
+
+		// Send the image to the group and repair pages missed by each target
+		void program(uint32_t group_address, uint16_t port = Protocol::PORT);
+
+		// Send a parity frame after each group of writes, so targets can rebuild a lost write.
+		// Used only if all targets support CAP_STREAM_PARITY.
+		void set_parity(bool parity) { _parity = parity; }
+
+		// Number of writes protected by a parity frame, adapted to the loss observed by the last program()
+		size_t get_parity_group() const { return _parity_group; }
+
+	private:
+		typedef std::array<std::byte, DeviceDescriptor::ERASE_SIZE> Page;
+
+		// Time needed by the target to process a stream write, there is no acknowledgement to wait for
+		static constexpr auto WRITE_INTERVAL = std::chrono::microseconds(3000);
+		// Time needed by the target to erase a page before the first write into it
+		static constexpr auto ERASE_INTERVAL = std::chrono::microseconds(36000);
+
+		static constexpr size_t MIN_PARITY_GROUP = 2;
+		static constexpr size_t DEFAULT_PARITY_GROUP = 8;
+
+		// Send all pages to the group, followed by parity frames if parity_group isn't 0
+		void stream(const sockaddr_in& group, size_t parity_group);
+
+		// Choose the parity group size for the next stream from the fraction of pages lost
+		void adapt_parity(size_t lost, size_t sent);
+
+		// Write pages which the target didn't receive. Returns number of repaired pages.
+		size_t repair(NetworkProgrammer& target);
+
+		// Image split into erase pages
+		std::map<size_t, Page> _pages;
+		std::vector<NetworkProgrammer*> _targets;
+		SocketUDP _socket;
+		uint16_t _session;
+		uint8_t _seq;
+		bool _parity;
+		size_t _parity_group;
+};
+
+} // namespace programmer
+
+#endif /* __STREAM_HPP__ */
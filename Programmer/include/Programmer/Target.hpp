@@ -9,30 +9,296 @@
 #define __TARGET_HPP__
 
 #include <cinttypes>
+#include <cstdio>
 #include <vector>
+#include <array>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <span>
+#include <filesystem>
 
 #include <Programmer/Network.hpp>
+#include <Programmer/protocol.hpp>
+#include <Programmer/Flash.hpp>
 
 namespace programmer {
 
 class Target {
 	public:
-		Target(uint16_t dev_id, size_t flash_size);
+		// Board listening on the port of the address, INADDR_ANY listens on all interfaces. Flash size is in bytes.
+		Target(uint16_t dev_id, size_t flash_size, uint16_t port = Protocol::PORT, uint32_t address = INADDR_ANY);
+
+		// Keep the flash in a sparse file, content of an existing file is loaded
+		void map_flash(const std::filesystem::path& path);
+
+		// Save the flash content, to be shared later by boards restored from it
+		void save_flash(const std::filesystem::path& path) const { _flash->save(path); }
+
+		// Set the flash to the snapshot. Pages are shared until written, restoring again discards the written ones.
+		// Statistics, erase counts and the stream state start over.
+		void restore_flash(std::shared_ptr<const FlashSnapshot> snapshot);
+
+		size_t get_flash_size() const { return _flash->size(); }
+
+		// Receive stream writes sent to a multicast or broadcast group
+		void join_group(uint32_t group_address, uint16_t port = Protocol::PORT);
+
+		// Simulate a factory-fresh board. It ignores all requests until an OP_NET_CONFIG addressed to its MAC arrives.
+		void set_unconfigured(const MacAddress& mac);
+
+		// Duration of operations on the simulated flash in microseconds, all zero answers immediately
+		struct Timing {
+			uint32_t erase_us;
+			uint32_t write_us;			// Per sector
+			uint32_t read_us;
+			uint32_t checksum_page_us;	// Per page of a checksum or blank check
+			double jitter;				// Each duration varies uniformly by this fraction
+			bool reject_busy;			// Drop requests arriving during an operation instead of queueing them
+		};
+
+		// Durations measured on the real device
+		static constexpr Timing REALISTIC = { 33000, 2800, 100, 500, 0.1, false };
+
+		// Model operation durations. Jitter is reproducible for the seed.
+		void set_timing(const Timing& timing, uint32_t seed = 1);
+
+		// Send replies of finished operations. Returns time of the next pending reply or time_point::max().
+		std::chrono::steady_clock::time_point send_replies();
+
+		// Print every frame, disable to simulate many boards
+		void set_verbose(bool verbose) { _verbose = verbose; }
+
+		// Bind the board's socket, requests are then handled by service()
+		void open(bool nonblocking);
+
+		// Handle all requests waiting in the socket. Returns number of received frames.
+		size_t service(SocketUDP& socket);
+
+		SocketUDP& get_socket() { return _socket; }
+		SocketUDP* get_group_socket() { return _group_socket.get(); }
+
+		struct Statistics {
+			uint64_t rx_frames;
+			uint64_t tx_frames;
+			uint64_t tx_dropped;	// Replies lost to a full socket buffer
+			uint64_t erases;	// Erased pages
+			uint64_t writes;	// Written sectors
+		};
+
+		const Statistics& get_statistics() const { return _stats; }
+
+		// Number of erases of each page, to measure wear caused by the programmer
+		std::span<const uint32_t> get_erase_counts() const { return _erase_counts; }
+
+		void clear_statistics();
+
+		// Serve requests forever
 		void start();
 	private:
 		static constexpr uint32_t ERASE_SIZE = 1024;
 		static constexpr uint32_t WRITE_SIZE = 64;
+		static constexpr uint32_t CAPABILITIES = Protocol::CAP_QUIET_ACK | Protocol::CAP_COMPOUND |
+			Protocol::CAP_CHECKSUM | Protocol::CAP_CHECKSUM_PAGES | Protocol::CAP_BLANK_CHECK |
+			Protocol::CAP_ERASE_WRITE | Protocol::CAP_CHIP_ERASE | Protocol::CAP_PACKED_WRITE |
+			Protocol::CAP_STREAM | Protocol::CAP_STREAM_PARITY;
+		static constexpr uint32_t SECTORS_PER_PAGE = ERASE_SIZE / WRITE_SIZE;
+
+		// Bootloader is aligned to its size, below the last page which holds the configuration words
+		static constexpr uint32_t BOOTLOADER_SIZE = 2 * ERASE_SIZE;
+		static constexpr uint16_t BOOTLOADER_VERSION = 0x0100;
+		// Like the real bootloader a reply carries at most half a page, a whole page read fails with STATUS_INV_LENGTH
+		static constexpr uint16_t MAX_REPLY = sizeof(Protocol::ReplyHeader) + ERASE_SIZE / 2;
+
+		// Approximate duration of operations on the real device, reported to the host by STATUS_INPROGRESS
+		static constexpr uint32_t ERASE_TIME_US = REALISTIC.erase_us;
+		static constexpr uint32_t WRITE_TIME_US = REALISTIC.write_us;
+		static constexpr uint32_t READ_TIME_US = REALISTIC.read_us;
+		static constexpr uint32_t CHECKSUM_PAGE_TIME_US = REALISTIC.checksum_page_us;
+
+		union Frame {
+			std::byte raw[1500];
+			union {
+				struct {
+					Protocol::RequestHeader header;
+					union {
+						Protocol::Write write;
+						Protocol::EraseWrite erase_write;
+						Protocol::StreamWrite stream_write;
+						Protocol::StreamStatus stream_status;
+						Protocol::StreamParity stream_parity;
+						Protocol::Discover discover;
+						Protocol::NetworkConfig net_config;
+					};
+				} request;
+				struct {
+					Protocol::ReplyHeader header;
+					union {
+						Protocol::DiscoverReplyExt dr;
+						unsigned char payload[1500 - sizeof(Protocol::ReplyHeader)];
+					};
+				} reply;
+			};
+		};
+
+		// Handle a received request
+		void process(Frame& frame, int len, const sockaddr_in& rx_addr);
+
+		template <typename... Args>
+		void log(const char* format, Args... args) const {
+			if (_verbose)
+				printf(format, args...);
+		}
 
 		static const char* get_operation_name(uint8_t op);
 		static const char* get_status_name(uint8_t stat);
 
 		void hexdump(const void* buf, size_t len);
 		void send(const void* buf, size_t size, const sockaddr_in* addr);
+		// Send a reply now, a full socket buffer loses it like the network would
+		void transmit(std::span<const std::byte> data, const sockaddr_in* addr);
+
+		// A factory-fresh board answers from the address assigned by OP_NET_CONFIG
+		void assign_address(uint32_t address);
+		void acknowledge(void* buf, uint32_t duration_us, const sockaddr_in* addr);
+
+		// Final reply of the current request is sent after the modelled duration of its operation
+		void delay(uint32_t duration_us);
+
+		// The bootloader can't be erased or overwritten
+		bool is_protected(uint32_t address, uint32_t length) const;
+
+		Protocol::Status check_erase(uint32_t address) const;
+		void erase(uint32_t address);
+		Protocol::Status check_write(uint32_t address, uint32_t length = WRITE_SIZE) const;
+		void write(uint32_t address, const void* data);
+
+		// A plain write carries a single sector
+		Protocol::Status check_sector(uint32_t address, uint32_t length) const;
+
+		// Start over after OP_RESET, the programmer has to discover the board again
+		void reboot();
+
+		// Decode packed write data and validate its destination
+		Protocol::Status unpack(uint32_t address, std::span<const std::byte> packed,
+								std::span<std::byte, ERASE_SIZE> data, size_t& size) const;
+
+		// Write a sector received from the stream, erasing its page first if needed
+		void stream_write(uint32_t address, uint16_t session, const void* data);
+
+		// Rebuild a single lost stream write of a group from its parity
+		void stream_parity(uint8_t seq, uint16_t count, uint32_t address, uint16_t session, const std::byte* data);
 
 		const uint16_t _dev_id;
-		std::vector<std::byte> _flash;
+		uint32_t _bootloader_address;
+		const uint16_t _port;
+		const uint32_t _address;
+		bool _verbose;
+		uint32_t _capabilities;
+		MacAddress _mac;
+		bool _has_mac;		// OP_NET_CONFIG for other MAC addresses is ignored
+		bool _configured;
+
+		// Host which sent the last discover, the only one allowed to program the board
+		sockaddr_in _programmer_addr;
+		uint8_t _last_seq;
+		Statistics _stats;
+		Frame _frame;
+
+		// Timing model
+		Timing _timing;
+		std::minstd_rand _jitter_rng;
+		std::chrono::steady_clock::time_point _busy_until;		// End of the last accepted operation
+		std::chrono::steady_clock::time_point _reply_time;		// When the reply of the current request is due
+
+		struct DelayedReply {
+			std::chrono::steady_clock::time_point time;
+			sockaddr_in address;
+			std::vector<std::byte> data;
+		};
+		std::deque<DelayedReply> _replies;
+		std::unique_ptr<FlashMemory> _flash;
+		std::vector<uint32_t> _erase_counts;
 		SocketUDP _socket;
+		std::unique_ptr<SocketUDP> _group_socket;
+		std::unique_ptr<SocketUDP> _assigned_socket;	// Bound to the address from OP_NET_CONFIG, replies are sent from it
+
+		// Sectors of each page received in the current stream session, one bit per sector
+		uint16_t _stream_session;
+		std::vector<uint16_t> _stream_sectors;
+		static_assert(SECTORS_PER_PAGE <= 16, "Stream sector bitmap too small");
+
+		// Recently received stream writes, indexed by sequence number
+		struct StreamFrame {
+			bool valid;
+			uint8_t seq;
+			uint16_t session;
+			uint32_t address;
+			std::array<std::byte, WRITE_SIZE> data;
+		};
+		std::array<StreamFrame, Protocol::MAX_PARITY_GROUP * 2> _stream_frames;
+};
+
+/* Several simulated targets, each one in its own thread, listening on consecutive ports
+ * and sharing a stream group. Used to test one-to-many programming.
+ */
+class TargetGroup {
+	public:
+		TargetGroup(size_t count, uint16_t dev_id, size_t flash_size, uint16_t base_port,
+					uint32_t group_address, uint16_t group_port = Protocol::PORT);
+
+		// Make all targets factory-fresh boards with consecutive MAC addresses starting at base_mac
+		void set_unconfigured(const MacAddress& base_mac);
+
+		// Run all targets, blocks like Target::start()
+		void start();
+
+	private:
+		std::vector<std::unique_ptr<Target>> _targets;
+};
+
+/* Thousands of simulated boards in one process, used to load test programming of a fleet.
+ * Boards are spread over worker threads, each one serving its boards from a single poll set.
+ * Board i listens on base_port + i, or on base_address + i with the same port if an address
+ * is given, e.g. aliases of the loopback in 127.0.0.0/8.
+ */
+class TargetFleet {
+	public:
+		// Boards cycle through the devices, each one with the flash size of its device. 0 workers uses a thread per core.
+		TargetFleet(size_t count, std::span<const uint16_t> dev_ids, uint16_t base_port,
+					uint32_t base_address = INADDR_ANY, size_t workers = 0);
+
+		// Model operation durations of all boards, each one with its own jitter sequence
+		void set_timing(const Target::Timing& timing, uint32_t seed = 1);
+
+		// Keep flash of each board in its own sparse file in the directory, board-<n>.flash
+		void map_flash(const std::filesystem::path& directory);
+
+		// Set flash of boards with the snapshot's flash size to it, only while the fleet isn't running.
+		// Returns number of restored boards.
+		size_t restore_flash(const std::filesystem::path& snapshot);
+
+		// Run all boards, reporting the throughput every second if requested. Blocks until stop().
+		void start(bool report = true);
+		void stop() { _running = false; }
+
+		// Requests handled by all boards
+		uint64_t get_rx_frames() const;
+
+		// Statistics summed over all boards, only while the fleet isn't running
+		Target::Statistics get_statistics() const;
+		// Most erases of a single page of any board
+		uint32_t get_max_erase_count() const;
+
+	private:
+		void serve(size_t worker);
 
+		std::vector<std::unique_ptr<Target>> _targets;
+		std::vector<std::atomic<uint64_t>> _rx_frames;	// Per worker
+		std::atomic<bool> _running;
 };
 
 } // namespace programmer
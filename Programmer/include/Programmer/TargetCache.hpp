@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright(c) 2023 Koko Software. All rights reserved.
+ *
+ * Author: Adrian Warecki <embedded@kokosoftware.pl>
+ */
+
+#ifndef __TARGETCACHE_HPP__
+#define __TARGETCACHE_HPP__
+
+#include <cstdint>
+#include <chrono>
+#include <array>
+#include <vector>
+#include <filesystem>
+
+#include <Programmer/Programmer.hpp>
+#include <Programmer/Discovery.hpp>
+
+namespace programmer {
+
+/* Targets known from previous runs, stored in a text file. A cached target is connected with
+ * a single unicast discover, which also validates the entry. Entries failing the validation
+ * are dropped and the target is discovered again only when it is needed.
+ */
+class TargetCache {
+	public:
+		struct Entry {
+			uint32_t ip_address;	// Network byte order
+			uint16_t port;
+			MacAddress mac;			// Zero if the target is behind a router
+			NetworkProgrammer::BootloaderInfo bootloader;
+			std::chrono::microseconds rtt;
+		};
+
+		// Load the cache, a missing file is an empty cache
+		TargetCache(const std::filesystem::path& path);
+
+		const Entry* find(uint32_t ip_address) const;
+		const Entry* find(const MacAddress& mac) const;
+
+		void store(const Entry& entry);
+		void invalidate(uint32_t ip_address);
+
+		// Write the cache back if it was changed
+		void save();
+
+		// Connect to a target at the address, validating and updating its entry
+		void connect(NetworkProgrammer& programmer, uint32_t ip_address, uint16_t port = Protocol::PORT);
+
+		// Connect to a target with the MAC address. Falls back to the discovery if the cached address doesn't lead to it.
+		void connect(NetworkProgrammer& programmer, const MacAddress& mac, Discovery& discovery);
+
+		// Get MAC address of a target on a local network with ARP, zero if it doesn't respond
+		static MacAddress resolve(uint32_t ip_address);
+
+	private:
+		// Store the target the programmer is connected to
+		void learn(const NetworkProgrammer& programmer, uint32_t ip_address, uint16_t port, const Entry* cached);
+
+		const std::filesystem::path _path;
+		std::vector<Entry> _entries;
+		bool _dirty;
+};
+
+} // namespace programmer
+
+#endif /* __TARGETCACHE_HPP__ */
@@ -9,14 +9,22 @@
 #define __TARGETTESTER_HPP__
 
 #include <cstdint>
+#include <cstdio>
 #include <random>
 #include <array>
 #include <chrono>
-#include <queue>
 #include <memory>
 #include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <new>
 
 #include <Programmer/Network.hpp>
+#include <Programmer/Pacer.hpp>
+#include <Programmer/Ring.hpp>
+#include <Programmer/Payload.hpp>
 #include <Programmer/Programmer.hpp>
 #include <Programmer/protocol.hpp>
 
@@ -31,23 +39,56 @@ constexpr int TARGET_BUFFER_SIZE = 512;	/* Targets transmit buffer size. Frames
 static constexpr long long TIMEOUT = 500;
 constexpr size_t QUEUE_FILL_LEVEL = 5;
 
-class Timer {
-	public:
-		Timer(int64_t time);
-		~Timer();
-		bool check();
-	private:
-		HANDLE _handle;
-};
-
-/* Class to test network stack - packet receiving and transmitting */
+/* Class to test network stack - packet receiving and transmitting.
+ * Requests are generated and sent by one thread, responses are received and verified by another.
+ * Frames in flight pass between them through a lock-free ring, the calling thread reports statistics.
+ */
 class TargetNetworkTester {
 	public:
-		TargetNetworkTester(uint32_t address);
+		// Payload size of each request chosen at random
+		static constexpr int RANDOM_PAYLOAD = -1;
 
+		struct Config {
+			size_t window;		// Requests in flight
+			double max_rate;	// Pacing limit in bytes per second
+			uint16_t port;
+			int payload_size;	// Payload of each request or RANDOM_PAYLOAD
+			bool verbose;		// Print events of the test
+		};
+
+		// Ethernet controller of a target
+		static constexpr Config DEFAULT = { QUEUE_FILL_LEVEL, 12.5 * 1000 * 1000, Protocol::PORT, RANDOM_PAYLOAD, true };
+		// Gigabit link to a TargetNetworkResponder
+		static constexpr Config LINE_RATE = { 48, 125.0 * 1000 * 1000, Protocol::PORT, RANDOM_PAYLOAD, true };
+
+		TargetNetworkTester(uint32_t address, const Config& config = DEFAULT);
+
+		// Run the test until stop()
 		void test();
+		void stop();
+
+		// Sustained performance of the test
+		struct Measurement {
+			double seconds;
+			uint64_t tx_frames;
+			uint64_t rx_frames;
+			uint64_t lost_frames;	// Requests or responses lost, or timed out
+			uint64_t errors;		// Responses with an invalid payload
+			double goodput;			// Verified payload bytes per second
+			double loss;			// Part of the requests lost
+			// Percentiles of the round trip time in microseconds
+			double rtt_p50;
+			double rtt_p90;
+			double rtt_p99;
+			double rtt_p999;
+		};
+
+		// Run the test for the warmup, then measure it for the time
+		Measurement measure(std::chrono::milliseconds warmup, std::chrono::milliseconds time);
+
 		static void print_size(uint64_t value);
-	private:
+
+		// Frames of the test, also used by TargetNetworkResponder
 		typedef struct {
 			uint32_t seq;
 		} Request;
@@ -68,63 +109,155 @@ class TargetNetworkTester {
 
 		// (eth + ip + udp + transmit status vector + per - packet control byte)
 		static constexpr long long TARGET_HEADERS = 14 + 20 + 8 + 7;
+
+		// Sequence number of a request clearing the target's counters
+		static constexpr uint32_t SEQ_CLEAR = 0x80000000;
+
 		static constexpr long long BUFFER_SIZE = ENDLESS_TX ? 1024 : TARGET_BUFFER_SIZE;
+		// Largest payload echoed by the target
 		static constexpr long long MAX_PAYLOAD = BUFFER_SIZE - TARGET_HEADERS - sizeof(Response);
+
+	private:
+		// Largest frame in the target's receive buffer
+		static constexpr long long MAX_RX_FRAME = TARGET_HEADERS + sizeof(Request) + MAX_PAYLOAD;
+		// Pacing of requests in bytes per second
+		static constexpr double MIN_RATE = 8 * 1024;
+		static constexpr double INITIAL_RATE = 64 * 1024;
 		// Preamble + start delimiter + inter packet gap
 		static constexpr long long ETH_LAYER1_SIZE = 7 + 1 + 12;
 		// phy + eth + ip + udp + frame check sequence
 		static constexpr long long NET_HEADERS_SIZE = ETH_LAYER1_SIZE + 0x00E + 0x014 + 0x008 + 4;
+		// Frames which can be in flight
+		static constexpr size_t RING_SIZE = 64;
+		// Sequence number without the clear flag
+		static constexpr uint32_t SEQ_MASK = ~SEQ_CLEAR;
+		// Socket buffers absorbing bursts at line rate
+		static constexpr int SOCKET_BUFFER_SIZE = 4 * 1024 * 1024;
+		static constexpr auto STATS_INTERVAL = std::chrono::seconds(10);
+		// Round trip times are counted in 16 buckets per power of two microseconds
+		static constexpr size_t LATENCY_SUB_BUCKETS = 16;
+		static constexpr size_t LATENCY_BUCKETS = (64 - 3) * LATENCY_SUB_BUCKETS;
 
 		enum Command {
 			COMMAND_CLEAR = 1
 		};
 
+		// Payload is generated from the sequence number, so it isn't stored
 		typedef struct {
 			uint32_t seq;
 			int payload_size;
+			std::chrono::steady_clock::time_point sent;
 			uint8_t command;
-			uint8_t payload[BUFFER_SIZE];
 		} Frame;
 
+		// Counter written by a single thread and read by the others
+		class Counter {
+			public:
+				Counter() : _value(0) {}
+				void operator++(int) { *this += 1; }
+				void operator+=(uint64_t value) {
+					_value.store(_value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+				}
+				uint64_t get() const { return _value.load(std::memory_order_relaxed); }
+
+			private:
+				std::atomic<uint64_t> _value;
+		};
+
+		// Transmitter thread
+		void transmit();
+		void send(bool clear = false);
+
+		// Receiver thread
+		void receive();
 		bool received(const void* response, int len);
 		void timeout();
-		void send(bool clear = false);
 
-		void prepare_payload(uint8_t* tx_buf, Frame& frame);
+		// Print statistics of both threads
+		void report();
+
+		// Run both threads, the monitor runs in the calling thread until the test stops
+		void run(const std::function<void()>& monitor);
+
+		// Wait for the time. Returns true if the test stopped.
+		bool wait_stop(std::chrono::milliseconds time);
+
+		// Print a message about an event of the test
+		template <typename... Args>
+		void event(const char* format, Args... args) const {
+			if (_config.verbose)
+				printf(format, args...);
+		}
+
+		static size_t latency_bucket(uint64_t us);
+		// Middle of the bucket in microseconds
+		static double bucket_latency(size_t bucket);
+
+		// Counters of both threads at a time
+		struct Snapshot {
+			std::chrono::steady_clock::time_point time;
+			uint64_t tx;
+			uint64_t rx;
+			uint64_t lost;
+			uint64_t errors;
+			uint64_t payload_bytes;
+			std::array<uint64_t, LATENCY_BUCKETS> latency;
+		};
+
+		Snapshot snapshot() const;
 
 		void check_ESTAT(uint8_t ESTAT);
 		void check_RCON(uint8_t RCON);
 		void check_STKPTR(uint8_t STKPTR);
 
-		Response _last_response;
-		std::ranlux24_base _rand_eng;
-		std::uniform_int_distribution<unsigned long> _rand_distr;
-
+		const Config _config;
 		SocketUDP _socket;
-		std::array<struct pollfd, 1> _poll;
 		struct sockaddr_in _tx_address;
 		struct sockaddr_in _rx_address;
 
-		Timer _stats_timer;
-		bool _timeout;
+		// Frames sent and waiting for a response
+		SpscRing<Frame, RING_SIZE> _ring;
+
+		// Fed back by the receiver, read by the transmitter
+		std::mutex _pacer_lock;
+		Pacer _pacer;
+
+		std::atomic<bool> _running;
+		std::atomic<bool> _report;		// Receiver prints the next response
+		std::mutex _stop_lock;
+		std::condition_variable _stop;
+		std::exception_ptr _error;		// First failure of a thread
+
+		// Random key of the session for TestPayload
+		const uint64_t _key;
 
-		std::queue<Frame> _queue;
+		// Owned by the transmitter
 		uint32_t _seq;
 
-		struct {
-			uint32_t rx;
-			uint32_t tx;
-			uint32_t timeout;
-			uint32_t lost_rx;
-			uint32_t lost_tx;
-			uint32_t payload_size;
-			uint32_t payload_invalid;
-			uint32_t seq_mismatch;
-
-			uint64_t tx_total_bytes;
-			uint64_t rx_total_bytes;
-			std::chrono::steady_clock::time_point start_time;
-		} _stats;
+		// Owned by the receiver
+		Response _last_response;
+		bool _timeout;
+
+		std::chrono::steady_clock::time_point _start_time;
+
+		struct alignas(std::hardware_destructive_interference_size) {
+			Counter tx;
+			Counter tx_total_bytes;
+		} _tx_stats;
+
+		struct alignas(std::hardware_destructive_interference_size) {
+			Counter rx;
+			Counter timeout;
+			Counter lost_rx;
+			Counter lost_tx;
+			Counter payload_size;
+			Counter payload_invalid;
+			Counter seq_mismatch;
+			Counter unexpected;		// Responses to frames no longer in flight
+			Counter rx_total_bytes;
+			Counter payload_bytes;	// Of verified responses
+			std::array<Counter, LATENCY_BUCKETS> latency;
+		} _rx_stats;
 
 		enum {
 			// RCON bitfield definitions
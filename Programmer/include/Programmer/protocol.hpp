@@ -9,11 +9,15 @@
 
 #include <cinttypes>
 #include <bit>
+#include <span>
 
 namespace programmer::Protocol {
 	constexpr uint16_t PORT = 666;
 	constexpr uint16_t VERSION = 1;
 
+	// Largest UDP payload which doesn't need fragmentation on Ethernet
+	constexpr size_t MAX_FRAME = 1500 - 20 - 8;
+
 	template <typename T>
 		requires std::is_integral<T>::value
 	struct bigendian {
@@ -42,6 +46,9 @@ namespace programmer::Protocol {
 	typedef bigendian<uint32_t> be32_t;
 	typedef uint16_t le16_t;
 
+	// Operations expected to complete faster than this are answered only with the final status when CAP_QUIET_ACK is negotiated
+	constexpr uint32_t QUIET_ACK_THRESHOLD_US = 5000;
+
 	enum Operation : uint8_t {
 		OP_DISCOVER,	// Reply: DiscoverReply
 		OP_NET_CONFIG,	// Reply: DiscoverReply
@@ -52,6 +59,13 @@ namespace programmer::Protocol {
 		OP_ERASE_WRITE,	// Reply: Header with STATUS_INPROGRESS, STATUS_OK
 		OP_CHIP_ERASE,	// Reply: Header with STATUS_INPROGRESS, STATUS_OK
 		OP_CHECKSUM,	// Reply: ChecksumReply
+		OP_CHECKSUM_PAGES,	// Reply: ChecksumPagesReply with STATUS_INPROGRESS, STATUS_OK
+		OP_BLANK_CHECK,	// Reply: BlankCheckReply with STATUS_INPROGRESS, STATUS_OK
+		OP_COMPOUND,	// Reply: CompoundReply with STATUS_INPROGRESS, STATUS_OK
+		OP_WRITE_PACKED,	// Reply: Header with STATUS_INPROGRESS, STATUS_OK
+		OP_STREAM_WRITE,	// No reply
+		OP_STREAM_STATUS,	// Reply: StreamStatusReply
+		OP_STREAM_PARITY,	// No reply
 	};
 
 	enum Status : uint8_t {
@@ -67,6 +81,25 @@ namespace programmer::Protocol {
 		STATUS_PKT_SIZE			// Invalid packet size
 	};
 
+	// Capabilities requested by the host in Discover / NetworkConfig. Target replies with the negotiated subset.
+	enum Capability : uint32_t {
+		CAP_QUIET_ACK		= 1 << 0,	// STATUS_INPROGRESS is omitted for operations faster than QUIET_ACK_THRESHOLD_US
+		CAP_COMPOUND		= 1 << 1,	// OP_COMPOUND is supported
+		CAP_CHECKSUM		= 1 << 2,	// OP_CHECKSUM is supported
+		CAP_CHECKSUM_PAGES	= 1 << 3,	// OP_CHECKSUM_PAGES is supported
+		CAP_BLANK_CHECK		= 1 << 4,	// OP_BLANK_CHECK is supported
+		CAP_ERASE_WRITE		= 1 << 5,	// OP_ERASE_WRITE is supported
+		CAP_CHIP_ERASE		= 1 << 6,	// OP_CHIP_ERASE is supported
+		CAP_PACKED_WRITE	= 1 << 7,	// OP_WRITE_PACKED is supported
+		CAP_STREAM			= 1 << 8,	// OP_STREAM_WRITE and OP_STREAM_STATUS are supported
+		CAP_STREAM_PARITY	= 1 << 9,	// OP_STREAM_PARITY is supported
+	};
+
+	enum ChecksumAlgorithm : uint8_t {
+		CHECKSUM_UNKNOWN,		// Not reported by the target
+		CHECKSUM_FLETCHER32,	// Protocol::checksum()
+	};
+
 	PACKED_STRUCT_BEGIN
 		struct RequestHeader {
 		be8_t version;
@@ -87,6 +120,13 @@ namespace programmer::Protocol {
 	};
 	PACKED_STRUCT_END
 
+	PACKED_STRUCT_BEGIN
+	struct Discover {
+		static constexpr uint8_t Operation = OP_DISCOVER;
+		be32_t capabilities;	// Requested capabilities
+	};
+	PACKED_STRUCT_END
+
 	PACKED_STRUCT_BEGIN
 	struct DiscoverReply {
 		be16_t version;
@@ -95,12 +135,27 @@ namespace programmer::Protocol {
 	};
 	PACKED_STRUCT_END
 
+	// DiscoverReply with the extension. Older bootloaders send DiscoverReply only.
+	PACKED_STRUCT_BEGIN
+	struct DiscoverReplyExt {
+		be16_t version;
+		be32_t bootloader_address;
+		le16_t device_id;
+		be32_t capabilities;	// Negotiated capabilities
+		be16_t max_request;		// Largest request frame accepted by the target
+		be16_t max_reply;		// Largest reply frame sent by the target
+		be8_t window;			// Number of requests the target can buffer
+		be8_t checksum;			// ChecksumAlgorithm used by OP_CHECKSUM and OP_CHECKSUM_PAGES
+	};
+	PACKED_STRUCT_END
+
 	PACKED_STRUCT_BEGIN
 	struct NetworkConfig {
 		static constexpr uint8_t Operation = OP_NET_CONFIG;
 		uint8_t mac_address[6];
 		uint32_t ip_address;
 		//uint8_t mac_address_eth[6];
+		be32_t capabilities;	// Requested capabilities
 	};
 	PACKED_STRUCT_END
 
@@ -114,10 +169,125 @@ namespace programmer::Protocol {
 		be8_t data[64];
 	};
 
+	// Request: address, length = size of the PackBits encoded payload.
+	// Decoded data must be a multiple of the write size and fit in a single erase page.
+	struct WritePacked {
+		static constexpr uint8_t Operation = OP_WRITE_PACKED;
+		be8_t data[1];
+	};
+
+	// Erase the page at address and write the first sector of it
+	struct EraseWrite {
+		static constexpr uint8_t Operation = OP_ERASE_WRITE;
+		be32_t address;
+		be8_t data[64];
+	};
+
+	// Write sent once to a multicast or broadcast group, targets don't reply to it.
+	// Request: address of the sector. Accepted only from the address of the connected programmer.
+	// The first sector received for an erase page in a session erases that page.
+	struct StreamWrite {
+		static constexpr uint8_t Operation = OP_STREAM_WRITE;
+		be16_t session;		// Chosen by the host, a new session forgets received sectors
+		be8_t data[64];
+	};
+
+	// Request: address of the first page, length = number of pages.
+	struct StreamStatus {
+		static constexpr uint8_t Operation = OP_STREAM_STATUS;
+		be16_t session;
+	};
+
+	// Reply contains the current session of the target and a bitmap with one bit per page, LSB first.
+	// A set bit marks a page whose all sectors were received in the requested session.
+	struct StreamStatusReply {
+		be16_t session;
+		be8_t bitmap[1];
+	};
+
+	// Largest number of stream writes protected by a single parity frame
+	constexpr size_t MAX_PARITY_GROUP = 16;
+
+	// Parity of stream writes with sequence numbers from seq - length to seq - 1.
+	// Request: address = XOR of addresses, length = number of writes in the group.
+	// A target which lost exactly one write of the group rebuilds it from the parity and the other writes.
+	struct StreamParity {
+		static constexpr uint8_t Operation = OP_STREAM_PARITY;
+		be16_t session;
+		be8_t data[64];		// XOR of data of the writes
+	};
+
 	struct ChecksumReply {
 		be32_t checksum;
 	};
 
+	// Request: address of the first page, length = number of pages.
+	// Reply contains one checksum for each requested erase page.
+	struct ChecksumPagesReply {
+		be32_t checksum[1];
+	};
+
+	// Request: address of the first page, length = number of pages.
+	// Reply contains a bitmap with one bit per page, LSB first. A set bit marks a fully erased (0xFF) page.
+	struct BlankCheckReply {
+		be8_t bitmap[1];
+	};
+
+	// Request: length = number of operations. The header is followed by the operations,
+	// each one a RequestHeader with its payload. Only OP_ERASE, OP_WRITE and OP_WRITE_PACKED are allowed.
+	// Operations are executed in order until the first failure.
+	// Reply contains a status of each operation, STATUS_REQUEST marks an operation which wasn't executed.
+	struct CompoundReply {
+		be8_t status[1];
+	};
+
+	// Operations which leave the flash unchanged, executing them again has no effect
+	constexpr bool is_idempotent(Operation operation) noexcept {
+		switch (operation) {
+			case OP_DISCOVER:
+			case OP_NET_CONFIG:
+			case OP_READ:
+			case OP_CHECKSUM:
+			case OP_CHECKSUM_PAGES:
+			case OP_BLANK_CHECK:
+			case OP_STREAM_STATUS:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	// Size of a payload following an operation header in a compound request, -1 if the operation isn't allowed
+	constexpr int compound_payload_size(const RequestHeader& header) noexcept {
+		switch (header.operation) {
+			case OP_ERASE:
+				return 0;
+			case OP_WRITE:
+				return sizeof(Write);
+			case OP_WRITE_PACKED:
+				return header.length;
+			default:
+				return -1;
+		}
+	}
+
+	// Checksum of a memory region. Fletcher-32 over little endian words, cheap enough for the bootloader.
+	constexpr uint32_t checksum(std::span<const std::byte> data) noexcept {
+		uint32_t sum1 = 0xFFFF;
+		uint32_t sum2 = 0xFFFF;
+
+		for (size_t i = 0; i < data.size(); i += 2) {
+			uint32_t word = static_cast<uint8_t>(data[i]);
+			if (i + 1 < data.size())
+				word |= static_cast<uint8_t>(data[i + 1]) << 8;
+
+			sum1 = (sum1 + word) % 0xFFFF;
+			sum2 = (sum2 + sum1) % 0xFFFF;
+		}
+
+		return (sum2 << 16) | sum1;
+	}
+
 } // namespace programmer
 
 #endif // !__PROTOCOL_HPP__
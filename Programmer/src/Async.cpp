@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Copyright(c) 2023 Koko Software. All rights reserved.
+//
+// Author: Adrian Warecki <embedded@kokosoftware.pl>
+
+#include <algorithm>
+#include <thread>
+
+#include <Programmer/Async.hpp>
+
+namespace programmer {
+
+// Start a task. It is owned by the reactor and runs in run().
+void Reactor::spawn(Task<void>&& task) {
+	_tasks.push_back(std::move(task));
+	_tasks.back().start();
+}
+
+// Call the handler whenever the socket is readable. Watchers don't keep run() going.
+void Reactor::watch(SOCKET socket, std::function<void()> handler) {
+	_watchers.push_back({ socket, std::move(handler) });
+}
+
+void Reactor::unwatch(SOCKET socket) {
+	std::erase_if(_watchers, [socket](const Watcher& watcher) { return watcher.socket == socket; });
+}
+
+// Process events until all spawned tasks finish. Rethrows the first exception of a task.
+void Reactor::run() {
+	using std::chrono::milliseconds;
+
+	std::vector<struct pollfd> fds;
+	std::vector<Waiter> ready;
+
+	while (!_waiters.empty()) {
+		auto deadline = clock::time_point::max();
+		fds.clear();
+		for (const Waiter& waiter : _waiters) {
+			deadline = std::min(deadline, waiter.deadline);
+			if (waiter.socket != INVALID_SOCKET)
+				fds.push_back({ waiter.socket, POLLIN, 0 });
+
+			// Signaled by a handler of a previous iteration
+			if (waiter.event && waiter.event->signaled)
+				deadline = clock::time_point::min();
+		}
+
+		const size_t watched = fds.size();
+		for (const Watcher& watcher : _watchers)
+			fds.push_back({ watcher.socket, POLLIN, 0 });
+
+		// Round up, so a wake up doesn't come before the deadline
+		const auto now = clock::now();
+		int timeout = (deadline > now) ? static_cast<int>(std::chrono::ceil<milliseconds>(deadline - now).count()) : 0;
+		if (deadline == clock::time_point::max())
+			timeout = -1;
+
+		if (fds.empty())
+			std::this_thread::sleep_for(milliseconds(timeout));
+		else
+			Network::poll(fds, timeout);
+
+		// Handlers may signal events of waiting tasks
+		for (size_t i = watched; i < fds.size(); i++)
+			if (fds[i].revents & (POLLIN | POLLERR | POLLHUP))
+				_watchers[i - watched].handler();
+
+		// Resuming a task may add new waiters, so collect the ready ones first
+		const auto wake = clock::now();
+		size_t fd = 0;
+		ready.clear();
+		std::erase_if(_waiters, [&](Waiter& waiter) {
+			bool signaled = (waiter.socket != INVALID_SOCKET) && (fds[fd++].revents & (POLLIN | POLLERR | POLLHUP));
+			if (waiter.event)
+				signaled = std::exchange(waiter.event->signaled, false);
+
+			if (!signaled && (waiter.deadline > wake))
+				return false;
+
+			*waiter.ready = signaled;
+			ready.push_back(waiter);
+			return true;
+		});
+
+		for (Waiter& waiter : ready)
+			waiter.handle.resume();
+	}
+
+	auto tasks = std::move(_tasks);
+	_tasks.clear();
+	for (auto& task : tasks)
+		task.result();
+}
+
+} // namespace programmer
@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Copyright(c) 2023 Koko Software. All rights reserved.
+//
+// Author: Adrian Warecki <embedded@kokosoftware.pl>
+
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <format>
+#include <fstream>
+
+#include <Programmer/types.hpp>
+#include <Programmer/Benchmark.hpp>
+#include <Programmer/Compression.hpp>
+#include <Programmer/Programmer.hpp>
+#include <Programmer/protocol.hpp>
+#include <Programmer/Target.hpp>
+
+namespace programmer {
+
+CompressionBenchmark::CompressionBenchmark(const Image& image) {
+	for (const Section& sec : image.sections()) {
+		auto data = sec.data();
+
+		for (size_t address = sec.address(); address < sec.end_address(); address++) {
+			const size_t sector_addr = address & ~size_t(DeviceDescriptor::WRITE_SIZE - 1);
+			auto [sector, inserted] = _sectors.try_emplace(sector_addr);
+			if (inserted)
+				sector->second.fill(std::byte(0xFF));
+
+			sector->second[address - sector_addr] = data[address - sec.address()];
+		}
+	}
+}
+
+// Measure throughput of a codec function in MB/s
+template <typename F>
+double CompressionBenchmark::measure(F&& fun, size_t bytes_per_pass) {
+	using std::chrono::steady_clock;
+	using std::chrono::duration;
+
+	constexpr auto MIN_TIME = std::chrono::milliseconds(200);
+	size_t passes = 0;
+
+	const auto start = steady_clock::now();
+	auto now = start;
+	do {
+		fun();
+		passes++;
+		now = steady_clock::now();
+	} while (now - start < MIN_TIME);
+
+	const double seconds = duration<double>(now - start).count();
+	return bytes_per_pass * passes / seconds / (1000.0 * 1000);
+}
+
+void CompressionBenchmark::run() {
+	constexpr size_t HEADER = sizeof(Protocol::RequestHeader);
+	constexpr size_t PLAIN_ITEM = HEADER + sizeof(Protocol::Write);
+
+	std::vector<std::vector<std::byte>> packed;
+	size_t raw_bytes = 0;
+	size_t plain_bytes = 0;
+	size_t packed_bytes = 0;
+	size_t packed_sectors = 0;
+
+	packed.reserve(_sectors.size());
+	for (const auto& [address, sector] : _sectors) {
+		std::vector<std::byte> out(PackBits::max_encoded_size(sector.size()));
+		out.resize(PackBits::encode(sector, out));
+
+		raw_bytes += sector.size();
+		plain_bytes += PLAIN_ITEM;
+
+		// Same rule as NetworkProgrammer: pack only if it saves enough
+		if (out.size() && (out.size() <= NetworkProgrammer::MAX_PACKED_SIZE)) {
+			packed_bytes += HEADER + out.size();
+			packed_sectors++;
+		} else
+			packed_bytes += PLAIN_ITEM;
+
+		packed.push_back(std::move(out));
+	}
+
+	if (!raw_bytes) {
+		printf("Image is empty.\n");
+		return;
+	}
+
+	std::vector<std::byte> scratch(PackBits::max_encoded_size(DeviceDescriptor::WRITE_SIZE));
+	const double encode_rate = measure([&] {
+		for (const auto& [address, sector] : _sectors)
+			PackBits::encode(sector, scratch);
+	}, raw_bytes);
+
+	const double decode_rate = measure([&] {
+		for (const auto& out : packed)
+			PackBits::decode(out, scratch);
+	}, raw_bytes);
+
+	const size_t plain_frames = (plain_bytes + Protocol::MAX_FRAME - HEADER - 1) / (Protocol::MAX_FRAME - HEADER);
+	const size_t packed_frames = (packed_bytes + Protocol::MAX_FRAME - HEADER - 1) / (Protocol::MAX_FRAME - HEADER);
+
+	printf("Sectors...........: %zu (%zu packed)\n", _sectors.size(), packed_sectors);
+	printf("Image data........: %zu bytes\n", raw_bytes);
+	printf("Plain writes......: %zu bytes, %zu compound frames\n", plain_bytes, plain_frames);
+	printf("Packed writes.....: %zu bytes, %zu compound frames\n", packed_bytes, packed_frames);
+	printf("Ratio.............: %.2f\n", static_cast<double>(plain_bytes) / packed_bytes);
+	printf("Encode............: %.1f MB/s\n", encode_rate);
+	printf("Decode............: %.1f MB/s\n", decode_rate);
+}
+
+NetworkBenchmark::NetworkBenchmark(const Image& image, uint16_t port) : _port(port) {
+	for (const Section& sec : image.sections()) {
+		auto data = sec.data();
+
+		for (size_t address = sec.address(); address < sec.end_address(); address++) {
+			const size_t page_addr = address & ~size_t(DeviceDescriptor::ERASE_SIZE - 1);
+			auto [page, inserted] = _pages.try_emplace(page_addr);
+			if (inserted)
+				page->second.fill(std::byte(0xFF));
+
+			page->second[address - page_addr] = data[address - sec.address()];
+		}
+	}
+}
+
+// Program the image through a proxy with the given profile
+NetworkBenchmark::Result NetworkBenchmark::measure(const ImpairmentProxy::Profile& profile, uint32_t seed) {
+	const uint16_t devices[] = { DeviceDescriptor::PIC18F97J60 << 5 };
+	const uint16_t proxy_port = static_cast<uint16_t>(_port + 1);
+	const uint32_t loopback = Network::htonl()(INADDR_LOOPBACK);
+
+	TargetFleet target(1, devices, _port);
+	target.set_timing(Target::REALISTIC, seed);
+	ImpairmentProxy proxy(proxy_port, loopback, _port, profile, seed);
+
+	std::thread target_thread(&TargetFleet::start, &target, false);
+	std::thread proxy_thread(&ImpairmentProxy::run, &proxy);
+
+	// Both threads must be joined on any exit
+	auto shutdown = [&] {
+		proxy.stop();
+		target.stop();
+		proxy_thread.join();
+		target_thread.join();
+	};
+
+	Result result{};
+	NetworkProgrammer prog;
+	const auto start = std::chrono::steady_clock::now();
+	try {
+		prog.connect_device(loopback, proxy_port);
+
+		for (const auto& [address, page] : _pages) {
+			prog.queue_erase(static_cast<uint32_t>(address));
+			for (size_t offset = 0; offset < page.size(); offset += DeviceDescriptor::WRITE_SIZE)
+				prog.queue_write(static_cast<uint32_t>(address + offset),
+								 std::span(page).subspan(offset, DeviceDescriptor::WRITE_SIZE));
+		}
+		prog.flush();
+		result.completed = true;
+	}
+	catch (const Exception&) {
+		// Gave up on the link, reported as a failed run
+	}
+	catch (...) {
+		shutdown();
+		throw;
+	}
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	shutdown();
+
+	result.programmer = prog.get_statistics();
+	result.proxy = proxy.get_statistics();
+	result.target = target.get_statistics();
+	result.wear = target.get_max_erase_count();
+	return result;
+}
+
+void NetworkBenchmark::run(uint32_t seed) {
+	if (_pages.empty()) {
+		printf("Image is empty.\n");
+		return;
+	}
+
+	printf("Pages: %zu, seed: %u\n", _pages.size(), seed);
+	printf("%-12s %10s %8s %8s %8s %8s %8s %8s %8s %6s\n", "Profile", "Time [s]", "Tx", "Rx", "Retrans", "Dropped", "Dup",
+		   "Erases", "Writes", "Wear");
+
+	for (const ImpairmentProxy::Profile& profile : ImpairmentProxy::PROFILES) {
+		const Result result = measure(profile, seed);
+
+		printf("%-12s ", profile.name);
+		if (result.completed)
+			printf("%10.2f ", result.seconds);
+		else
+			printf("%10s ", "failed");
+		printf("%8llu %8llu %8llu %8llu %8llu %8llu %8llu %6u\n",
+			   static_cast<unsigned long long>(result.programmer.tx_frames),
+			   static_cast<unsigned long long>(result.programmer.rx_frames),
+			   static_cast<unsigned long long>(result.programmer.retransmissions),
+			   static_cast<unsigned long long>(result.proxy.dropped),
+			   static_cast<unsigned long long>(result.proxy.duplicated),
+			   static_cast<unsigned long long>(result.target.erases),
+			   static_cast<unsigned long long>(result.target.writes),
+			   static_cast<unsigned>(result.wear));
+	}
+}
+
+// Payload sizes from tiny frames up to the largest one echoed by the target
+const std::vector<int> FrameSizeBenchmark::PAYLOAD_SIZES = {
+	16, 32, 64, 128, 192, 256, 320, 384, static_cast<int>(TargetNetworkTester::MAX_PAYLOAD)
+};
+
+const std::vector<size_t> FrameSizeBenchmark::WINDOWS = { 1, 2, 3, 5, 8, 16, 32 };
+
+FrameSizeBenchmark::FrameSizeBenchmark(uint32_t address, const TargetNetworkTester::Config& config)
+	: _address(address), _config(config)
+{
+}
+
+void FrameSizeBenchmark::run(const std::vector<int>& payload_sizes, const std::vector<size_t>& windows,
+							 std::chrono::milliseconds warmup, std::chrono::milliseconds time) {
+	printf("%8s %6s %14s %8s %8s %10s %10s %10s %10s\n", "Payload", "Window", "Goodput [kB/s]", "Loss [%]",
+		   "Errors", "p50 [us]", "p90 [us]", "p99 [us]", "p99.9 [us]");
+
+	_points.clear();
+	for (int payload_size : payload_sizes) {
+		for (size_t window : windows) {
+			TargetNetworkTester::Config config = _config;
+			config.payload_size = payload_size;
+			config.window = window;
+			config.verbose = false;
+
+			// Each point starts a new session, so the pacer doesn't carry over
+			TargetNetworkTester tester(_address, config);
+			const TargetNetworkTester::Measurement result = tester.measure(warmup, time);
+			_points.push_back({ payload_size, window, result });
+
+			printf("%8d %6zu %14.1f %8.2f %8llu %10.0f %10.0f %10.0f %10.0f\n", payload_size, window,
+				   result.goodput / 1000, result.loss * 100, static_cast<unsigned long long>(result.errors),
+				   result.rtt_p50, result.rtt_p90, result.rtt_p99, result.rtt_p999);
+		}
+	}
+}
+
+void FrameSizeBenchmark::save_csv(std::ostream& out) const {
+	out << "payload_size,window,seconds,tx_frames,rx_frames,lost_frames,errors,goodput,loss,"
+		   "rtt_p50_us,rtt_p90_us,rtt_p99_us,rtt_p999_us\n";
+
+	for (const Point& point : _points) {
+		const TargetNetworkTester::Measurement& r = point.result;
+		out << std::format("{},{},{:.3f},{},{},{},{},{:.1f},{:.6f},{:.1f},{:.1f},{:.1f},{:.1f}\n",
+						   point.payload_size, point.window, r.seconds, r.tx_frames, r.rx_frames, r.lost_frames,
+						   r.errors, r.goodput, r.loss, r.rtt_p50, r.rtt_p90, r.rtt_p99, r.rtt_p999);
+	}
+}
+
+void FrameSizeBenchmark::save_json(std::ostream& out) const {
+	out << "[\n";
+	for (size_t i = 0; i < _points.size(); i++) {
+		const Point& point = _points[i];
+		const TargetNetworkTester::Measurement& r = point.result;
+		out << std::format("\t{{ \"payload_size\": {}, \"window\": {}, \"seconds\": {:.3f}, \"tx_frames\": {}, "
+						   "\"rx_frames\": {}, \"lost_frames\": {}, \"errors\": {}, \"goodput\": {:.1f}, "
+						   "\"loss\": {:.6f}, \"rtt_p50_us\": {:.1f}, \"rtt_p90_us\": {:.1f}, "
+						   "\"rtt_p99_us\": {:.1f}, \"rtt_p999_us\": {:.1f} }}{}\n",
+						   point.payload_size, point.window, r.seconds, r.tx_frames, r.rx_frames, r.lost_frames,
+						   r.errors, r.goodput, r.loss, r.rtt_p50, r.rtt_p90, r.rtt_p99, r.rtt_p999,
+						   (i + 1 < _points.size()) ? "," : "");
+	}
+	out << "]\n";
+}
+
+// Save the table as JSON if the file has .json extension, CSV otherwise
+void FrameSizeBenchmark::save(const std::filesystem::path& path) const {
+	std::ofstream file(path, std::ios::trunc);
+	if (path.extension() == ".json")
+		save_json(file);
+	else
+		save_csv(file);
+
+	if (!file)
+		throw Exception("Unable to save the table to {}.", path.string());
+}
+
+} // namespace programmer
@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Copyright(c) 2023 Koko Software. All rights reserved.
+//
+// Author: Adrian Warecki <embedded@kokosoftware.pl>
+
+#include <cstring>
+#include <algorithm>
+
+#include <Programmer/Compression.hpp>
+
+namespace programmer {
+
+// Encode data. Returns size of encoded data or 0 if it doesn't fit into the output buffer.
+size_t PackBits::encode(std::span<const std::byte> input, std::span<std::byte> output) noexcept {
+	size_t in = 0;
+	size_t out = 0;
+	size_t literal = 0;	// Start of pending literal bytes
+
+	auto flush_literal = [&](size_t end) {
+		while (literal < end) {
+			const size_t count = std::min(end - literal, MAX_LITERAL);
+			if (out + 1 + count > output.size())
+				return false;
+
+			output[out++] = std::byte(count - 1);
+			std::memcpy(&output[out], &input[literal], count);
+			out += count;
+			literal += count;
+		}
+		return true;
+	};
+
+	while (in < input.size()) {
+		// Measure run starting at current position
+		size_t run = 1;
+		while ((in + run < input.size()) && (run < MAX_RUN) && (input[in + run] == input[in]))
+			run++;
+
+		if (run < MIN_RUN) {
+			in += run;
+			continue;
+		}
+
+		if (!flush_literal(in) || (out + 2 > output.size()))
+			return 0;
+
+		output[out++] = std::byte(257 - run);
+		output[out++] = input[in];
+		in += run;
+		literal = in;
+	}
+
+	if (!flush_literal(in))
+		return 0;
+
+	return out;
+}
+
+// Decode data. Returns size of decoded data or SIZE_MAX if the input is malformed or the output is too small.
+size_t PackBits::decode(std::span<const std::byte> input, std::span<std::byte> output) noexcept {
+	size_t in = 0;
+	size_t out = 0;
+
+	while (in < input.size()) {
+		const uint8_t control = static_cast<uint8_t>(input[in++]);
+
+		if (control < 128) {
+			const size_t count = control + 1;
+			if ((in + count > input.size()) || (out + count > output.size()))
+				return SIZE_MAX;
+
+			std::memcpy(&output[out], &input[in], count);
+			in += count;
+			out += count;
+		} else if (control > 128) {
+			const size_t count = 257 - control;
+			if ((in >= input.size()) || (out + count > output.size()))
+				return SIZE_MAX;
+
+			std::memset(&output[out], static_cast<uint8_t>(input[in++]), count);
+			out += count;
+		}
+	}
+
+	return out;
+}
+
+} // namespace programmer
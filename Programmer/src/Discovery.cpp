@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Copyright(c) 2023 Koko Software. All rights reserved.
+//
+// Author: Adrian Warecki <embedded@kokosoftware.pl>
+
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+
+#include <Windows.h>
+#include <iphlpapi.h>
+
+#include <Programmer/Pacer.hpp>
+#include <Programmer/Discovery.hpp>
+
+namespace programmer {
+
+Discovery::Discovery(uint32_t capabilities)
+	: _capabilities(capabilities), _request{}, _seq(0), _sent(0)
+{
+}
+
+// Enumerate interfaces which are up, loopback excluded
+std::vector<Discovery::Interface> Discovery::get_interfaces() {
+	constexpr ULONG flags = GAA_FLAG_SKIP_ANYCAST | GAA_FLAG_SKIP_MULTICAST | GAA_FLAG_SKIP_DNS_SERVER;
+	std::vector<std::byte> buffer(16 * 1024);
+	ULONG size;
+	ULONG ret;
+
+	do {
+		size = static_cast<ULONG>(buffer.size());
+		ret = GetAdaptersAddresses(AF_INET, flags, nullptr, reinterpret_cast<PIP_ADAPTER_ADDRESSES>(buffer.data()), &size);
+		if (ret == ERROR_BUFFER_OVERFLOW)
+			buffer.resize(size);
+	} while (ret == ERROR_BUFFER_OVERFLOW);
+
+	if (ret != NO_ERROR)
+		throw Exception("GetAdaptersAddresses failed with error {}.", ret);
+
+	std::vector<Interface> interfaces;
+	for (auto adapter = reinterpret_cast<PIP_ADAPTER_ADDRESSES>(buffer.data()); adapter; adapter = adapter->Next) {
+		if ((adapter->OperStatus != IfOperStatusUp) || (adapter->IfType == IF_TYPE_SOFTWARE_LOOPBACK))
+			continue;
+
+		for (auto unicast = adapter->FirstUnicastAddress; unicast; unicast = unicast->Next) {
+			if (unicast->Address.lpSockaddr->sa_family != AF_INET)
+				continue;
+
+			const uint8_t prefix = std::min<uint8_t>(unicast->OnLinkPrefixLength, 32);
+			const uint32_t mask = prefix ? ~0u << (32 - prefix) : 0;
+			interfaces.push_back({
+				reinterpret_cast<const sockaddr_in*>(unicast->Address.lpSockaddr)->sin_addr.s_addr,
+				Network::htonl()(mask)
+			});
+		}
+	}
+
+	return interfaces;
+}
+
+// Build a discover request with a new sequence number
+const Discovery::Request& Discovery::prepare_request() {
+	auto header = reinterpret_cast<Protocol::RequestHeader*>(_request.data());
+	header->version = Protocol::VERSION;
+	header->seq = ++_seq;
+	header->operation = Protocol::OP_DISCOVER;
+	header->status = Protocol::STATUS_REQUEST;
+	header->address = 0;
+	header->length = 0;
+
+	auto discover = reinterpret_cast<Protocol::Discover*>(_request.data() + sizeof(Protocol::RequestHeader));
+	discover->capabilities = _capabilities;
+
+	_sent++;
+	return _request;
+}
+
+// Receive pending replies from the socket. Replies from known targets are skipped.
+void Discovery::receive(SocketUDP& socket, uint32_t interface_address, std::vector<DiscoveredTarget>& targets) {
+	std::array<std::byte, Protocol::MAX_FRAME> buffer;
+
+	for (;;) {
+		sockaddr_in address;
+		int address_size = sizeof(address);
+
+		const int size = socket.recvfrom(buffer, 0, &address, &address_size);
+		if (size < 0)
+			break;
+
+		if (size < sizeof(Protocol::ReplyHeader) + sizeof(Protocol::DiscoverReply))
+			continue;
+
+		// Replies to any of the requests of this discovery are accepted
+		auto header = reinterpret_cast<const Protocol::ReplyHeader*>(buffer.data());
+		if ((header->version != Protocol::VERSION) || (header->operation != Protocol::OP_DISCOVER) ||
+			(header->status != Protocol::STATUS_OK) || (static_cast<uint8_t>(_seq - header->seq) >= _sent))
+			continue;
+
+		auto known = std::find_if(targets.begin(), targets.end(), [&address](const DiscoveredTarget& target) {
+			return target.address.sin_addr.s_addr == address.sin_addr.s_addr;
+		});
+		if (known != targets.end())
+			continue;
+
+		auto info = reinterpret_cast<const Protocol::DiscoverReply*>(buffer.data() + sizeof(Protocol::ReplyHeader));
+		DiscoveredTarget target{ address, interface_address, info->device_id, info->version, info->bootloader_address, 0 };
+
+		if (size >= sizeof(Protocol::ReplyHeader) + sizeof(Protocol::DiscoverReplyExt)) {
+			auto ext = reinterpret_cast<const Protocol::DiscoverReplyExt*>(info);
+			target.capabilities = ext->capabilities;
+		}
+
+		targets.push_back(target);
+	}
+}
+
+// Broadcast a discover on all interfaces and collect replies until the window passes
+std::vector<DiscoveredTarget> Discovery::discover(clock::duration window, uint16_t port) {
+	const auto interfaces = get_interfaces();
+	if (interfaces.empty())
+		throw Exception("No network interface available for discovery.");
+
+	// Socket bound to each interface, so the broadcast leaves through it
+	std::vector<std::unique_ptr<SocketUDP>> sockets;
+	std::vector<struct pollfd> fds;
+	for (const Interface& iface : interfaces) {
+		auto socket = std::make_unique<SocketUDP>();
+		sockaddr_in local{ AF_INET, 0 };
+		local.sin_addr.s_addr = iface.address;
+
+		socket->bind(&local);
+		socket->set_broadcast(true);
+		socket->receive_broadcast(false);
+		socket->set_nonblocking(true);
+
+		fds.push_back({ *socket, POLLIN, 0 });
+		sockets.push_back(std::move(socket));
+	}
+
+	std::vector<DiscoveredTarget> targets;
+	const auto start = clock::now();
+	const auto deadline = start + window;
+	auto next_request = start;
+	_sent = 0;
+
+	for (;;) {
+		auto now = clock::now();
+		if (now >= deadline)
+			break;
+
+		// Repeat the request to survive a lost broadcast
+		if ((_sent < ATTEMPTS) && (now >= next_request)) {
+			const auto& request = prepare_request();
+			for (size_t i = 0; i < sockets.size(); i++) {
+				sockaddr_in broadcast{ AF_INET, Network::htons()(port) };
+				broadcast.sin_addr.s_addr = interfaces[i].broadcast();
+
+				try {
+					sockets[i]->sendto(request, 0, &broadcast, sizeof(broadcast));
+				}
+				catch (const SocketException& e) {
+					// Interface went down, the others are still searched
+					printf("Discovery on interface %u failed: %s\n", static_cast<unsigned>(i), e.what());
+				}
+			}
+			next_request = start + window * _sent / (ATTEMPTS + 1);
+		}
+
+		const auto wake = (_sent < ATTEMPTS) ? std::min(deadline, next_request) : deadline;
+		Network::poll(fds, wake);
+
+		for (size_t i = 0; i < fds.size(); i++)
+			if (fds[i].revents & POLLIN)
+				receive(*sockets[i], interfaces[i].address, targets);
+	}
+
+	return targets;
+}
+
+// Probe every host of the network with a unicast discover
+std::vector<DiscoveredTarget> Discovery::sweep(uint32_t network, uint8_t prefix_length, double rate,
+											   clock::duration window, uint16_t port) {
+	if ((prefix_length == 0) || (prefix_length > 32))
+		throw Exception("Invalid network prefix length {}.", static_cast<unsigned>(prefix_length));
+
+	if (rate <= 0)
+		throw Exception("Invalid sweep rate.");
+
+	const uint32_t mask = ~0u << (32 - prefix_length);
+	uint32_t host = Network::ntohl()(network) & mask;
+	uint32_t last = host | ~mask;
+
+	// Skip the network and broadcast addresses, unless there are no others
+	if (prefix_length < 31) {
+		host++;
+		last--;
+	}
+
+	SocketUDP socket;
+	socket.set_nonblocking(true);
+	socket.report_unreachable(false);
+	socket.receive_broadcast(false);
+
+	std::array<struct pollfd, 1> fds{ { socket, POLLIN, 0 } };
+
+	// All probes carry the same sequence number, so replies to any of them are accepted
+	_sent = 0;
+	const auto& request = prepare_request();
+	const double frame_rate = rate * request.size();
+	Pacer pacer(frame_rate, frame_rate, frame_rate, SWEEP_BURST * request.size());
+
+	std::vector<DiscoveredTarget> targets;
+	auto deadline = clock::time_point::max();
+	bool sending = true;
+
+	for (;;) {
+		while (sending && pacer.ready()) {
+			sockaddr_in address{ AF_INET, Network::htons()(port) };
+			address.sin_addr.s_addr = Network::htonl()(host);
+
+			try {
+				socket.sendto(request, 0, &address, sizeof(address));
+			}
+			catch (const SocketException&) {
+				// Unreachable host, e.g. no route to it
+			}
+			pacer.sent(request.size());
+
+			if (host++ == last) {
+				sending = false;
+				deadline = clock::now() + window;
+			}
+		}
+
+		const auto now = clock::now();
+		if (now >= deadline)
+			break;
+
+		const auto wake = sending ? pacer.next() : deadline;
+		Network::poll(fds, wake);
+
+		if (fds[0].revents & POLLIN)
+			receive(socket, INADDR_ANY, targets);
+	}
+
+	return targets;
+}
+
+// Parse a network in the CIDR notation, e.g. 10.11.12.0/24
+void Discovery::parse_network(const char* cidr, uint32_t& network, uint8_t& prefix_length) {
+	const std::string text(cidr);
+	const auto slash = text.find('/');
+	const std::string address = text.substr(0, slash);
+
+	in_addr addr;
+	if (inet_pton(AF_INET, address.c_str(), &addr) != 1)
+		throw Exception("Invalid network address {}.", address);
+
+	unsigned long prefix = 32;
+	if (slash != std::string::npos) {
+		char* end;
+		const std::string length = text.substr(slash + 1);
+		prefix = strtoul(length.c_str(), &end, 10);
+		if (length.empty() || *end || (prefix == 0) || (prefix > 32))
+			throw Exception("Invalid network prefix length {}.", length);
+	}
+
+	network = addr.s_addr;
+	prefix_length = static_cast<uint8_t>(prefix);
+}
+
+void Discovery::print(const std::vector<DiscoveredTarget>& targets) {
+	printf("Found %u target(s)\n", static_cast<unsigned>(targets.size()));
+
+	for (const DiscoveredTarget& target : targets) {
+		char addr[INET_ADDRSTRLEN] = {};
+		char iface[INET_ADDRSTRLEN] = {};
+		inet_ntop(AF_INET, &target.address.sin_addr, addr, sizeof(addr));
+		inet_ntop(AF_INET, &target.interface_address, iface, sizeof(iface));
+
+		printf("%-15s via %-15s Device ID: %04X Bootloader: %u.%02u @ 0x%06X Capabilities: %08X\n", addr, iface,
+			   target.device_id, target.version >> 8, target.version & 0xff, target.bootloader_address, target.capabilities);
+	}
+}
+
+} // namespace programmer
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Copyright(c) 2023 Koko Software. All rights reserved.
+//
+// Author: Adrian Warecki <embedded@kokosoftware.pl>
+
+#include <algorithm>
+#include <fstream>
+#include <system_error>
+
+#include <winioctl.h>
+
+#include <Programmer/Flash.hpp>
+#include <Programmer/Exceptions.hpp>
+
+namespace programmer {
+
+FlashSnapshot::FlashSnapshot(const std::filesystem::path& path)
+	: _size(0), _file(INVALID_HANDLE_VALUE), _mapping(nullptr)
+{
+	_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (_file == INVALID_HANDLE_VALUE)
+		throw std::system_error(GetLastError(), std::system_category(), path.string());
+
+	LARGE_INTEGER file_size;
+	if (GetFileSizeEx(_file, &file_size))
+		_mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	if (!_mapping) {
+		const DWORD error = GetLastError();
+		CloseHandle(_file);
+		throw std::system_error(error, std::system_category(), path.string());
+	}
+
+	_size = static_cast<size_t>(file_size.QuadPart);
+}
+
+FlashSnapshot::~FlashSnapshot() {
+	CloseHandle(_mapping);
+	CloseHandle(_file);
+}
+
+// Erased flash in memory
+FlashMemory::FlashMemory(size_t size)
+	: _size(size), _memory(size), _data(_memory.data()), _file(INVALID_HANDLE_VALUE), _mapping(nullptr)
+{
+}
+
+// Flash in a sparse file, created erased if it doesn't exist
+FlashMemory::FlashMemory(size_t size, const std::filesystem::path& path)
+	: _size(size), _data(nullptr), _file(INVALID_HANDLE_VALUE), _mapping(nullptr)
+{
+	_file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+						FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (_file == INVALID_HANDLE_VALUE)
+		throw std::system_error(GetLastError(), std::system_category(), path.string());
+
+	// Mapping extends the file to the flash size, without allocating the erased pages
+	DWORD returned;
+	if (!DeviceIoControl(_file, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &returned, nullptr)) {
+		const DWORD error = GetLastError();
+		close();
+		throw std::system_error(error, std::system_category(), path.string());
+	}
+
+	const ULARGE_INTEGER file_size{ .QuadPart = size };
+	_mapping = CreateFileMappingW(_file, nullptr, PAGE_READWRITE, file_size.HighPart, file_size.LowPart, nullptr);
+	if (_mapping)
+		_data = static_cast<std::byte*>(MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+
+	if (!_data) {
+		const DWORD error = GetLastError();
+		close();
+		throw std::system_error(error, std::system_category(), path.string());
+	}
+}
+
+// Copy-on-write view of a snapshot, written pages become private to this flash
+FlashMemory::FlashMemory(std::shared_ptr<const FlashSnapshot> snapshot)
+	: _size(snapshot->size()), _data(nullptr), _file(INVALID_HANDLE_VALUE), _mapping(nullptr), _snapshot(std::move(snapshot))
+{
+	_data = static_cast<std::byte*>(MapViewOfFile(_snapshot->_mapping, FILE_MAP_COPY, 0, 0, _size));
+	if (!_data)
+		throw std::system_error(GetLastError(), std::system_category(), "MapViewOfFile");
+}
+
+FlashMemory::~FlashMemory() {
+	close();
+}
+
+// Release the mapping and the file
+void FlashMemory::close() {
+	if (_data && (_mapping || _snapshot))
+		UnmapViewOfFile(_data);
+	if (_mapping)
+		CloseHandle(_mapping);
+	if (_file != INVALID_HANDLE_VALUE)
+		CloseHandle(_file);
+
+	_data = nullptr;
+	_mapping = nullptr;
+	_file = INVALID_HANDLE_VALUE;
+	_snapshot.reset();
+}
+
+void FlashMemory::read(size_t address, std::span<std::byte> data) const {
+	std::transform(_data + address, _data + address + data.size(), data.begin(), [](std::byte b) { return ~b; });
+}
+
+void FlashMemory::write(size_t address, std::span<const std::byte> data) {
+	std::transform(data.begin(), data.end(), _data + address, [](std::byte b) { return ~b; });
+}
+
+void FlashMemory::erase(size_t address, size_t size) {
+	// Writing zeros would allocate the untouched pages of the sparse file
+	if (is_blank(address, size))
+		return;
+
+	std::fill(_data + address, _data + address + size, std::byte(0));
+}
+
+bool FlashMemory::is_blank(size_t address, size_t size) const {
+	return std::all_of(_data + address, _data + address + size, [](std::byte b) { return b == std::byte(0); });
+}
+
+// Save the content to a file, which can be then loaded by FlashSnapshot
+void FlashMemory::save(const std::filesystem::path& path) const {
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(_data), _size);
+	if (!file)
+		throw Exception("Unable to save flash to {}.", path.string());
+}
+
+} // namespace programmer
@@ -9,6 +9,7 @@
 
 #include <Programmer/types.hpp>
 #include <Programmer/Image.hpp>
+#include <Programmer/Programmer.hpp>
 
 namespace programmer {
 
@@ -88,6 +89,8 @@ void ImageProgrammer::program() {
 	std::array<std::byte, WRITE_SIZE> buffer;
 	
 	_sections.sort();
+	check_blank();
+
 	for (Section& sec : _sections) {
 		printf("0x%06zX - 0x%06zX\n", sec.address(), sec.address() + sec.size() - 1);
 		std::span<const std::byte>::iterator data = sec.data().begin();
@@ -110,7 +113,10 @@ void ImageProgrammer::program() {
 				// Erase page
 				if (sector_addr >= erase_end) {
 					auto erase_addr = erase_align(sector_addr);
-					erase(erase_addr);
+					if (is_blank(erase_addr))
+						printf("\tskip erase 0x%06zX - 0x%06zX (blank)\n", erase_addr, erase_addr + ERASE_SIZE - 1);
+					else
+						erase(erase_addr);
 					erase_end = erase_addr + ERASE_SIZE;
 				}
 			}
@@ -124,16 +130,59 @@ void ImageProgrammer::program() {
 			address += size;
 		}
 	}
-	write(sector_addr, buffer);
+
+	// Nothing was prepared for an empty image
+	if (sector_end)
+		write(sector_addr, buffer);
+
+	// Operations are packed into compound requests by the programmer
+	if (_programmer)
+		_programmer->flush();
+}
+
+
+// Query the target for pages which don't need to be erased
+void ImageProgrammer::check_blank() {
+	_blank.clear();
+
+	if (!_programmer || _sections.empty())
+		return;
+
+	// Sections are sorted, so the range spans from the first to the last one
+	_blank_address = erase_align(_sections.front().address());
+	const size_t end = _sections.back().end_address();
+	const size_t pages = (end - _blank_address + ERASE_SIZE - 1) / ERASE_SIZE;
+
+	try {
+		_blank = _programmer->blank_check(static_cast<uint32_t>(_blank_address), pages);
+	}
+	catch (Exception& err) {
+		// Not fatal, every page will be erased
+		printf("Blank check unavailable: %s\n", err.what());
+		_blank.clear();
+	}
 }
 
+bool ImageProgrammer::is_blank(size_t address) const {
+	if (address < _blank_address)
+		return false;
+
+	const size_t page = (address - _blank_address) / ERASE_SIZE;
+	return (page < _blank.size()) && _blank[page];
+}
 
 void ImageProgrammer::erase(size_t address) {
 	printf("\terase 0x%06zX - 0x%06zX\n", address, address + ERASE_SIZE - 1);
+
+	if (_programmer)
+		_programmer->queue_erase(static_cast<uint32_t>(address));
 }
 
 void ImageProgrammer::write(size_t address, const std::span<std::byte>& data) {
 	printf("\twrite 0x%06zX - 0x%06zX (%zu)\n", address, address + WRITE_SIZE - 1, data.size());
+
+	if (_programmer)
+		_programmer->queue_write(static_cast<uint32_t>(address), data);
 	/*
 	for (std::byte b : data)
 		printf("%02X", (unsigned char)b);
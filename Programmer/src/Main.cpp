@@ -13,15 +13,28 @@
 #include <Programmer/DeviceDescriptor.hpp>
 #include <Programmer/Target.hpp>
 #include <Programmer/TargetTester.hpp>
+#include <Programmer/Benchmark.hpp>
+#include <Programmer/Stream.hpp>
+#include <Programmer/Discovery.hpp>
+#include <Programmer/Provision.hpp>
+#include <Programmer/Responder.hpp>
+#include <Programmer/TargetCache.hpp>
 
 // TODO: Move this heaer to Network
 #include <ws2tcpip.h>
 
 
 //#define NET_TESTER
+//#define COMPRESSION_BENCH
+//#define NET_BENCH
+//#define STREAM_TEST
+//#define PROVISION_TEST
+//#define FLEET_SIM
+//#define PROGRAM
 #define BOOT_TESTER
 #define NET_CONFIG
 //#define DISCOVER
+//#define SWEEP
 
 int main(int argc, char** argv) {
 	try {
@@ -30,10 +43,150 @@ int main(int argc, char** argv) {
 		std::cout << "Hello World! " << argc << "\n";
 
 #ifdef NET_TESTER
-		IN_ADDR ip;
-		inet_pton(AF_INET, "10.11.12.13", &ip);
-		TargetNetworkTester test(ip.s_addr);
-		test.test();
+		// Usage: Programmer responder [line] - simulate the firmware of the test
+		//        Programmer sweep <address> <table.csv|table.json> [line] - measure payload sizes and windows
+		//        Programmer [address] [line] - test network stack of a target, 10.11.12.13 by default
+		// With "line" both sides run at the rate of a gigabit link instead of the Ethernet controller.
+		const bool line_rate = (argc > 2) && (std::string_view(argv[argc - 1]) == "line");
+		if ((argc > 1) && (std::string_view(argv[1]) == "responder")) {
+			programmer::TargetNetworkResponder responder(line_rate ? programmer::TargetNetworkResponder::LINE_RATE :
+														 programmer::TargetNetworkResponder::DEFAULT);
+			responder.start();
+		} else if ((argc > 3) && (std::string_view(argv[1]) == "sweep")) {
+			IN_ADDR ip;
+			inet_pton(AF_INET, argv[2], &ip);
+			programmer::FrameSizeBenchmark bench(ip.s_addr, line_rate ? programmer::TargetNetworkTester::LINE_RATE :
+												 programmer::TargetNetworkTester::DEFAULT);
+			bench.run();
+			bench.save(argv[3]);
+		} else {
+			IN_ADDR ip;
+			inet_pton(AF_INET, (argc > 1) ? argv[1] : "10.11.12.13", &ip);
+			programmer::TargetNetworkTester test(ip.s_addr, line_rate ? programmer::TargetNetworkTester::LINE_RATE :
+												 programmer::TargetNetworkTester::DEFAULT);
+			test.test();
+		}
+#elif defined(COMPRESSION_BENCH)
+		// Usage: Programmer <image.hex|image.elf>
+		if (argc < 2)
+			throw programmer::Exception("Image file not specified.");
+
+		programmer::ImageProgrammer img;
+		const std::filesystem::path path(argv[1]);
+		if (path.extension() == ".hex")
+			programmer::Hex::read(path, img);
+		else
+			programmer::Elf(path).read_image(img);
+
+		programmer::CompressionBenchmark bench(img);
+		bench.run();
+#elif defined(NET_BENCH)
+		// Usage: Programmer <image.hex> [seed]
+		if (argc < 2)
+			throw programmer::Exception("Image file not specified.");
+
+		programmer::ImageProgrammer img;
+		programmer::Hex::read(argv[1], img);
+
+		programmer::NetworkBenchmark bench(img);
+		bench.run((argc > 2) ? std::stoul(argv[2]) : 1);
+#elif defined(STREAM_TEST)
+		// Usage: Programmer targets - run simulated targets
+		//        Programmer <image.hex> - stream the image to them
+		constexpr size_t TARGETS = 4;
+		IN_ADDR group, ip;
+		inet_pton(AF_INET, "239.255.6.66", &group);
+		inet_pton(AF_INET, "127.0.0.1", &ip);
+		if (argc < 2)
+			throw programmer::Exception("Image file or targets not specified.");
+
+		if (std::string_view(argv[1]) == "targets") {
+			programmer::TargetGroup targets(TARGETS, programmer::DeviceDescriptor::PIC18F97J60 << 5, 128 * 1024,
+											programmer::Protocol::PORT + 1, group.s_addr);
+			targets.start();
+		} else {
+			programmer::ImageProgrammer img;
+			programmer::Hex::read(argv[1], img);
+
+			std::vector<std::unique_ptr<programmer::NetworkProgrammer>> progs;
+			programmer::StreamProgrammer stream(img, ip.s_addr);
+			programmer::Reactor reactor;
+			stream.set_parity(true);
+
+			// Connect to all targets at once
+			for (size_t i = 0; i < TARGETS; i++) {
+				progs.push_back(std::make_unique<programmer::NetworkProgrammer>());
+				reactor.spawn(progs.back()->connect_device_async(reactor, ip.s_addr,
+									static_cast<uint16_t>(programmer::Protocol::PORT + 1 + i)));
+				stream.add_target(progs.back().get());
+			}
+			reactor.run();
+			stream.program(group.s_addr);
+		}
+#elif defined(PROVISION_TEST)
+		// Usage: Programmer targets - run simulated factory-fresh targets
+		//        Programmer - assign them addresses
+		constexpr size_t TARGETS = 16;
+		const programmer::MacAddress base_mac = { 0x02, 0x00, 0x5E, 0x10, 0x00, 0x00 };
+		IN_ADDR first, last;
+		// Loopback aliases, so the simulated targets can answer from their assigned address
+		inet_pton(AF_INET, "127.0.2.100", &first);
+		inet_pton(AF_INET, "127.0.2.199", &last);
+
+		if ((argc > 1) && (std::string_view(argv[1]) == "targets")) {
+			programmer::TargetGroup targets(TARGETS, programmer::DeviceDescriptor::PIC18F97J60 << 5, 128 * 1024,
+											programmer::Protocol::PORT + 1, INADDR_BROADCAST);
+			targets.set_unconfigured(base_mac);
+			targets.start();
+		} else {
+			programmer::Provisioner provisioner(first.s_addr, last.s_addr);
+			for (size_t i = 0; i < TARGETS; i++) {
+				programmer::MacAddress mac = base_mac;
+				mac[5] = static_cast<uint8_t>(i);
+				provisioner.add_board(mac);
+			}
+
+			const size_t confirmed = provisioner.provision();
+			provisioner.print();
+			printf("%zu of %zu boards configured, %zu invalid replies\n", confirmed, TARGETS, provisioner.get_errors());
+		}
+#elif defined(FLEET_SIM)
+		// Usage: Programmer [boards] [flash directory|snapshot] - simulate boards on loopback aliases 127.0.1.1 and up
+		const size_t boards = (argc > 1) ? std::stoul(argv[1]) : 1000;
+		const uint16_t devices[] = {
+			programmer::DeviceDescriptor::PIC18F97J60 << 5,
+			programmer::DeviceDescriptor::PIC18F67J60 << 5,
+			programmer::DeviceDescriptor::PIC18F66J60 << 5,
+		};
+		IN_ADDR base;
+		inet_pton(AF_INET, "127.0.1.1", &base);
+
+		programmer::TargetFleet fleet(boards, devices, programmer::Protocol::PORT, base.s_addr);
+		fleet.set_timing(programmer::Target::REALISTIC);
+		if ((argc > 2) && std::filesystem::is_regular_file(argv[2]))
+			printf("%zu boards restored from the snapshot\n", fleet.restore_flash(argv[2]));
+		else if (argc > 2)
+			fleet.map_flash(argv[2]);
+		fleet.start();
+#elif defined(PROGRAM)
+		// Usage: Programmer <image.hex> <target MAC> - program the target, its address is cached in targets.cache
+		if (argc < 3)
+			throw programmer::Exception("Image file or target MAC address not specified.");
+
+		programmer::MacAddress mac;
+		if (!programmer::Network::parse_mac(argv[2], mac))
+			throw programmer::Exception("Invalid MAC address {}.", argv[2]);
+
+		// A target known from a previous run is connected without the discovery
+		auto net = std::make_unique<programmer::NetworkProgrammer>();
+		programmer::TargetCache cache("targets.cache");
+		programmer::Discovery discovery;
+		cache.connect(*net, mac, discovery);
+
+		programmer::Programmer prog(std::move(net));
+		programmer::ImageProgrammer img(&prog);
+		programmer::Hex::read(argv[1], img);
+		img.program();
 #elif defined(BOOT_TESTER)
 		auto prog = std::make_unique<programmer::NetworkProgrammer>();
 		IN_ADDR ip;
@@ -45,7 +198,7 @@ int main(int argc, char** argv) {
 		test.run_tests();
 #else
 		if (!!(argc > 1)) {
-			Target t(DeviceDescriptor::PIC18F97J60 << 5, 128);
+			Target t(DeviceDescriptor::PIC18F97J60 << 5, 128 * 1024);
 			t.start();
 		} else {
 			NetworkProgrammer prog;
@@ -59,13 +212,26 @@ int main(int argc, char** argv) {
 			prog.configure_device(ip.s_addr);
 #elif defined(DISCOVER)
 			/* On Windows, broadcast packets aren't sent out on every interface. They are only sent on the primary interface...
-			 * and I don't recall how Windows determines which that is. 
-			 * https://github.com/ubihazard/broadcast/
+			 * Discovery sends a directed broadcast from each interface instead.
 			 */
-			//prog.discover_device();
-			IN_ADDR ip;
-			inet_pton(AF_INET, "10.255.255.255", &ip);
-			prog.connect_device(ip.s_addr);
+			programmer::Discovery discovery;
+			auto targets = discovery.discover();
+			programmer::Discovery::print(targets);
+			if (targets.empty())
+				throw programmer::Exception("No target found.");
+			prog.connect_device(targets.front().address.sin_addr.s_addr);
+#elif defined(SWEEP)
+			// Unicast probes reach targets behind routers filtering broadcasts
+			uint32_t network;
+			uint8_t prefix_length;
+			programmer::Discovery::parse_network("10.11.12.0/24", network, prefix_length);
+
+			programmer::Discovery discovery;
+			auto targets = discovery.sweep(network, prefix_length);
+			programmer::Discovery::print(targets);
+			if (targets.empty())
+				throw programmer::Exception("No target found.");
+			prog.connect_device(targets.front().address.sin_addr.s_addr);
 #else
 			IN_ADDR ip;
 			//inet_pton(AF_INET, "192.168.128.101", &ip);
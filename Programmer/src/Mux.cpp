@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Copyright(c) 2023 Koko Software. All rights reserved.
+//
+// Author: Adrian Warecki <embedded@kokosoftware.pl>
+
+#include <Programmer/Mux.hpp>
+#include <Programmer/Async.hpp>
+
+namespace programmer {
+
+/* BufferPool */
+
+BufferPool::Buffer BufferPool::acquire() {
+	std::unique_ptr<Block> block;
+
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		if (!_free.empty()) {
+			block = std::move(_free.back());
+			_free.pop_back();
+		} else
+			_allocated++;
+	}
+
+	if (!block)
+		block = std::make_unique<Block>();
+
+	return Buffer(block.release(), Release{ this });
+}
+
+void BufferPool::release(Block* block) noexcept {
+	std::unique_ptr<Block> ptr(block);
+
+	try {
+		std::lock_guard<std::mutex> guard(_lock);
+		_free.push_back(std::move(ptr));
+	}
+	catch (...) {
+		// Out of memory, the block is freed instead
+	}
+}
+
+// Pool used by programmers unless told otherwise
+BufferPool& BufferPool::shared() {
+	static BufferPool pool;
+	return pool;
+}
+
+
+/* SessionMux */
+
+SessionMux::SessionMux(Reactor& reactor, BufferPool& pool)
+	: _reactor(reactor), _pool(pool), _stats{}
+{
+	_socket.set_dont_fragment(true);
+	_socket.receive_broadcast(false);
+	_socket.set_nonblocking(true);
+	_reactor.watch(_socket, [this] { dispatch(); });
+}
+
+SessionMux::~SessionMux() {
+	_reactor.unwatch(_socket);
+}
+
+// Route frames from the address to the session
+void SessionMux::attach(MuxSession* session, const sockaddr_in& address) {
+	_sessions[key(address)] = session;
+}
+
+void SessionMux::detach(MuxSession* session, const sockaddr_in& address) {
+	auto it = _sessions.find(key(address));
+	if ((it != _sessions.end()) && (it->second == session))
+		_sessions.erase(it);
+}
+
+void SessionMux::send(std::span<const std::byte> frame, const sockaddr_in& address) {
+	_socket.sendto(frame, 0, &address, sizeof(address));
+}
+
+// Receive all pending frames and pass them to the sessions
+void SessionMux::dispatch() {
+	for (;;) {
+		sockaddr_in address;
+		int address_size = sizeof(address);
+		auto buffer = _pool.acquire();
+
+		const int size = _socket.recvfrom(*buffer, 0, &address, &address_size);
+		if (size < 0)
+			break;
+
+		_stats.rx_frames++;
+		auto session = _sessions.find(key(address));
+		if (session == _sessions.end()) {
+			_stats.unknown_source++;
+			continue;
+		}
+
+		if (!session->second->deliver(std::move(buffer), size))
+			_stats.dropped++;
+	}
+}
+
+} // namespace programmer
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <exception>
 #include <memory>
+#include <algorithm>
 
 #include <winsock2.h>
 
@@ -29,4 +30,14 @@ void Network::cleanup() {
 	WSACleanup();
 }
 
+// Parse a MAC address in the 01:23:45:67:89:AB notation
+bool Network::parse_mac(const char* text, MacAddress& mac) {
+	unsigned bytes[6];
+	if (sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]) != 6)
+		return false;
+
+	std::copy(std::begin(bytes), std::end(bytes), mac.begin());
+	return true;
+}
+
 } // namespace programmer
@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Copyright(c) 2023 Koko Software. All rights reserved.
+//
+// Author: Adrian Warecki <embedded@kokosoftware.pl>
+
+#include <algorithm>
+#include <thread>
+
+#include <Programmer/Pacer.hpp>
+
+namespace programmer {
+
+Pacer::Pacer(double initial_rate, double min_rate, double max_rate, size_t buffer_size)
+	: _rate(initial_rate), _min_rate(min_rate), _max_rate(max_rate), _buffer_size(static_cast<double>(buffer_size)),
+	_burst(_buffer_size), _tokens(_buffer_size), _last(clock::now()), _srtt{}, _rttvar{}, _rtt_valid(false)
+{
+}
+
+void Pacer::refill(clock::time_point now) {
+	const double elapsed = std::chrono::duration<double>(now - _last).count();
+	_tokens = std::min(_tokens + elapsed * _rate, _burst);
+	_last = now;
+}
+
+// Check if a frame can be sent now
+bool Pacer::ready() {
+	refill(clock::now());
+	return _tokens > 0;
+}
+
+// Time when the next frame can be sent
+Pacer::clock::time_point Pacer::next() const {
+	if (_tokens > 0)
+		return _last;
+
+	return _last + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(-_tokens / _rate));
+}
+
+// Wait until a frame can be sent
+void Pacer::wait() {
+	while (!ready())
+		std::this_thread::sleep_until(next());
+}
+
+// Account a sent frame. The bucket may go into debt, a large frame only delays the next one.
+void Pacer::sent(size_t size) {
+	refill(clock::now());
+	_tokens -= static_cast<double>(size);
+}
+
+// Capacity of the target's receive buffer changed
+void Pacer::set_buffer_size(size_t buffer_size) {
+	_buffer_size = static_cast<double>(buffer_size);
+	_burst = _buffer_size;
+	_tokens = std::min(_tokens, _burst);
+}
+
+// Seed the round trip time, e.g. with one measured by a previous session
+void Pacer::set_rtt(clock::duration rtt) {
+	_srtt = rtt;
+	_rttvar = rtt / 2;
+	_rtt_valid = true;
+}
+
+// Frame was delivered after the given round trip time
+void Pacer::delivered(clock::duration rtt) {
+	// Smoothed round trip time as in RFC 6298
+	if (!_rtt_valid) {
+		_srtt = rtt;
+		_rttvar = rtt / 2;
+		_rtt_valid = true;
+	} else {
+		const auto err = (_srtt > rtt) ? _srtt - rtt : rtt - _srtt;
+		_rttvar = (_rttvar * 3 + err) / 4;
+		_srtt = (_srtt * 7 + rtt) / 8;
+	}
+
+	_rate = std::min(_rate * INCREASE, _max_rate);
+}
+
+// Frame was lost
+void Pacer::lost() {
+	_rate = std::max(_rate * DECREASE, _min_rate);
+
+	// Frames sent before the loss are likely lost too, start over with an empty bucket
+	refill(clock::now());
+	_tokens = std::min(_tokens, 0.0);
+}
+
+// Target reported number of bytes waiting in its receive buffer
+void Pacer::occupancy(size_t used) {
+	const double free = std::max(_buffer_size - static_cast<double>(used), 0.0);
+
+	// Don't burst more than the target can still take
+	_burst = std::max(free, 1.0);
+	_tokens = std::min(_tokens, _burst);
+
+	if (used * 2 > _buffer_size)
+		_rate = std::max(_rate * BACKOFF, _min_rate);
+}
+
+// Retransmission timeout derived from the measured round trip time
+Pacer::clock::duration Pacer::timeout(clock::duration max) const {
+	if (!_rtt_valid)
+		return max;
+
+	const clock::duration rto = _srtt + 4 * _rttvar;
+	return std::clamp<clock::duration>(rto, MIN_TIMEOUT, max);
+}
+
+} // namespace programmer
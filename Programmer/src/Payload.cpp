@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Copyright(c) 2023 Koko Software. All rights reserved.
+//
+// Author: Adrian Warecki <embedded@kokosoftware.pl>
+
+#include <cstring>
+
+#include <Programmer/Payload.hpp>
+
+namespace programmer {
+
+// Bytes are stored in little endian order, like on the target
+static constexpr size_t WORD = sizeof(uint64_t);
+static constexpr uint64_t BYTES = 0x0101010101010101ull;
+
+// splitmix64 of the counter, no state is carried between the words
+uint64_t TestPayload::random(uint64_t key, uint64_t counter) noexcept {
+	uint64_t z = key + counter * 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+uint64_t TestPayload::scan(uint64_t word, uint8_t& mask) noexcept {
+	word ^= word << 8;
+	word ^= word << 16;
+	word ^= word << 32;
+	word ^= mask * BYTES;
+	mask = static_cast<uint8_t>(word >> 56);
+	return word;
+}
+
+void TestPayload::generate(uint64_t key, uint32_t seq, std::span<std::byte> payload) noexcept {
+	const uint64_t base = static_cast<uint64_t>(seq) << 32;
+	size_t i = 0;
+
+	for (; i + WORD <= payload.size(); i += WORD) {
+		const uint64_t word = random(key, base | (i / WORD));
+		std::memcpy(payload.data() + i, &word, WORD);
+	}
+
+	if (i < payload.size()) {
+		const uint64_t word = random(key, base | (i / WORD));
+		std::memcpy(payload.data() + i, &word, payload.size() - i);
+	}
+}
+
+void TestPayload::echo(std::span<const std::byte> payload, std::span<std::byte> output) noexcept {
+	uint8_t mask = MASK;
+	size_t i = 0;
+
+	for (; i + WORD <= payload.size(); i += WORD) {
+		uint64_t word;
+		std::memcpy(&word, payload.data() + i, WORD);
+		word = scan(word, mask);
+		std::memcpy(output.data() + i, &word, WORD);
+	}
+
+	if (i < payload.size()) {
+		uint64_t word = 0;
+		std::memcpy(&word, payload.data() + i, payload.size() - i);
+		word = scan(word, mask);
+		std::memcpy(output.data() + i, &word, payload.size() - i);
+	}
+}
+
+bool TestPayload::verify(uint64_t key, uint32_t seq, std::span<const std::byte> echo) noexcept {
+	const uint64_t base = static_cast<uint64_t>(seq) << 32;
+	uint8_t mask = MASK;
+	uint64_t difference = 0;
+	size_t i = 0;
+
+	// Differences are accumulated, a valid echo is the common case
+	for (; i + WORD <= echo.size(); i += WORD) {
+		uint64_t word;
+		std::memcpy(&word, echo.data() + i, WORD);
+		difference |= word ^ scan(random(key, base | (i / WORD)), mask);
+	}
+
+	if (i < echo.size()) {
+		const size_t rest = echo.size() - i;
+		uint64_t word = 0;
+		std::memcpy(&word, echo.data() + i, rest);
+		// Bytes past the payload are not part of the echo
+		difference |= (word ^ scan(random(key, base | (i / WORD)), mask)) & ((1ull << (rest * 8)) - 1);
+	}
+
+	return !difference;
+}
+
+} // namespace programmer
@@ -7,9 +7,11 @@
 #include <chrono>
 #include <array>
 #include <cassert>
+#include <algorithm>
 
 #include <Programmer/Programmer.hpp>
 #include <Programmer/DeviceDescriptor.hpp>
+#include <Programmer/Compression.hpp>
 
 namespace programmer {
 
@@ -99,7 +101,7 @@ void Programmer::erase_write(uint32_t address, const std::span<const std::byte>&
 			(buffer.size_bytes() > device_descriptor()->ERASE_SIZE))
 			throw Exception("Size is beyond the capabilities of the programmer.");
 
-		_programmer->write(address, buffer);
+		_programmer->erase_write(address, buffer);
 	}
 	catch (Exception& err) {
 		err.prepend("Erase and write {} bytes at address {:#06X} failed.", buffer.size_bytes(), address);
@@ -129,14 +131,132 @@ uint32_t Programmer::checksum(uint32_t address, size_t size) {
 	}
 }
 
+// Calculate a checksum of each erase page in a range
+std::vector<uint32_t> Programmer::checksum_pages(uint32_t address, size_t pages) {
+	try {
+		if (address % device_descriptor()->ERASE_SIZE)
+			throw Exception("Address isn't aligned to erase block.");
+
+		if (!pages)
+			throw Exception("No pages requested.");
+
+		return _programmer->checksum_pages(address, pages);
+	}
+	catch (Exception& err) {
+		err.prepend("Unable to checksum {} pages at address {:#06X}.", pages, address);
+		throw;
+	}
+}
+
+// Check which erase pages in a range are blank
+std::vector<bool> Programmer::blank_check(uint32_t address, size_t pages) {
+	try {
+		if (address % device_descriptor()->ERASE_SIZE)
+			throw Exception("Address isn't aligned to erase block.");
+
+		if (!pages)
+			throw Exception("No pages requested.");
+
+		return _programmer->blank_check(address, pages);
+	}
+	catch (Exception& err) {
+		err.prepend("Unable to blank check {} pages at address {:#06X}.", pages, address);
+		throw;
+	}
+}
+
+
+// Queue erase of a device's memory
+void Programmer::queue_erase(uint32_t address) {
+	try {
+		if (address % device_descriptor()->ERASE_SIZE)
+			throw Exception("Address isn't aligned to erase block.");
+
+		_programmer->queue_erase(address);
+	}
+	catch (Exception& err) {
+		err.prepend("Erase device memory at address {:#06X} failed.", address);
+		throw;
+	}
+}
+
+// Queue write of a device's memory
+void Programmer::queue_write(uint32_t address, const std::span<const std::byte>& buffer) {
+	try {
+		if (address % device_descriptor()->WRITE_SIZE)
+			throw Exception("Address isn't aligned to the sector size.");
+
+		if (buffer.size_bytes() != device_descriptor()->WRITE_SIZE)
+			throw Exception("Size doesn't match the sector size.");
+
+		_programmer->queue_write(address, buffer);
+	}
+	catch (Exception& err) {
+		err.prepend("Write {} bytes at address {:#06X} failed.", buffer.size_bytes(), address);
+		throw;
+	}
+}
+
+// Execute queued operations
+void Programmer::flush() {
+	try {
+		_programmer->flush();
+	}
+	catch (Exception& err) {
+		err.prepend("Queued operations failed.");
+		throw;
+	}
+}
+
 
 /* IProgrammerStrategy */
 
-// Calculate a checksum of a device's memory
+// Calculate a checksum of a device's memory, read by the host
 uint32_t IProgrammerStrategy::checksum(uint32_t address, size_t size) {
+	// Flash is read by words
+	const size_t max_read = programmer_descriptor()->max_read & ~size_t(1);
+	std::vector<std::byte> data;
+	data.reserve(size);
+
+	while (data.size() < size) {
+		const size_t count = std::min(size - data.size(), max_read);
+		auto part = read(static_cast<uint32_t>(address + data.size()), count);
+		data.insert(data.end(), part.begin(), part.end());
+	}
+
+	return Protocol::checksum(data);
+}
+
+// Calculate a checksum of each erase page in a range
+std::vector<uint32_t> IProgrammerStrategy::checksum_pages(uint32_t address, size_t pages) {
+	std::vector<uint32_t> result;
+	result.reserve(pages);
+
+	for (size_t i = 0; i < pages; i++, address += DeviceDescriptor::ERASE_SIZE)
+		result.push_back(checksum(address, DeviceDescriptor::ERASE_SIZE));
+
+	return result;
+}
+
+// Check which erase pages in a range are blank
+std::vector<bool> IProgrammerStrategy::blank_check(uint32_t address, size_t pages) {
 	throw Exception("Operation is not supported.");
 }
 
+// Queue erase of a device's memory
+void IProgrammerStrategy::queue_erase(uint32_t address) {
+	erase(address);
+}
+
+// Queue write of a device's memory
+void IProgrammerStrategy::queue_write(uint32_t address, const std::span<const std::byte>& buffer) {
+	write(address, buffer);
+}
+
+// Execute queued operations
+void IProgrammerStrategy::flush() {
+}
+
 // Erase whole device memory
 void IProgrammerStrategy::chip_erase() {
 	throw Exception("Operation is not supported.");
@@ -184,30 +304,64 @@ ETarget::ETarget(const Protocol::Status status)
 
 /* NetworkProgrammer */
 
-const ProgrammerDescriptor NetworkProgrammer::_prog_desc = {
-	// max_write
-	NetworkProgrammer::ReceiveBuffer::MAX_PAYLOAD,
-	// TODO: NetworkProgrammer::TransmitBuffer::,
-	// max_read
-	NetworkProgrammer::ReceiveBuffer::MAX_PAYLOAD
-};
-
-
 NetworkProgrammer::NetworkProgrammer()
-	: _poll{ { _socket, POLLIN} },
+	: _mux(nullptr), _socket(std::make_unique<SocketUDP>()), _poll{ { *_socket, POLLIN} },
 	_tx_address{ AF_INET, Network::htons()(Protocol::PORT) },
-	IProgrammerStrategy(&_prog_desc)
+	_bootloader{}, _profile{}, _capabilities(HOST_CAPABILITIES), _stats{},
+	_descriptor{ sizeof(Protocol::Write::data), ReceiveBuffer::MAX_PAYLOAD },
+	_pacer(INITIAL_RATE, MIN_RATE, MAX_RATE, Protocol::MAX_FRAME),
+	IProgrammerStrategy(&_descriptor)
 { 
-	_socket.set_dont_fragment(true);
-	_socket.receive_broadcast(false);
+	_socket->set_dont_fragment(true);
+	_socket->receive_broadcast(false);
+}
+
+// Programmer sharing the socket of the mux. Supports only asynchronous operations with a unicast address.
+NetworkProgrammer::NetworkProgrammer(SessionMux& mux)
+	: _mux(&mux), _poll{},
+	_tx_address{ AF_INET, Network::htons()(Protocol::PORT) },
+	_bootloader{}, _profile{}, _capabilities(HOST_CAPABILITIES), _stats{},
+	_descriptor{ sizeof(Protocol::Write::data), ReceiveBuffer::MAX_PAYLOAD },
+	_pacer(INITIAL_RATE, MIN_RATE, MAX_RATE, Protocol::MAX_FRAME),
+	IProgrammerStrategy(&_descriptor)
+{
+}
+
+NetworkProgrammer::~NetworkProgrammer() {
+	if (_mux)
+		_mux->detach(this, _tx_address);
 }
 
 void NetworkProgrammer::set_address(uint32_t address, uint16_t port) {
+	if (_mux) {
+		if (address == INADDR_BROADCAST)
+			throw Exception("Broadcast isn't supported on a shared socket.");
+
+		_mux->detach(this, _tx_address);
+	}
+
 	_tx_address.sin_addr.s_addr = address;
 	_tx_address.sin_port = Network::htons()(port);
 
-	if (address == INADDR_BROADCAST)
-		_socket.set_broadcast(true);
+	if (_mux)
+		_mux->attach(this, _tx_address);
+	else if (address == INADDR_BROADCAST)
+		_socket->set_broadcast(true);
+}
+
+// Frame received by the mux
+bool NetworkProgrammer::deliver(BufferPool::Buffer&& buffer, size_t size) {
+	// Replies to older requests are of no use
+	if ((size < sizeof(Protocol::ReplyHeader)) ||
+		(reinterpret_cast<const Protocol::ReplyHeader*>(buffer->data())->seq != _tx_buf.get_sequence()))
+		return false;
+
+	if (_pending.size() >= MAX_PENDING)
+		_pending.pop_front();
+
+	_pending.emplace_back(std::move(buffer), size);
+	Reactor::notify(_received);
+	return true;
 }
 
 void NetworkProgrammer::check_connection() {
@@ -215,34 +369,120 @@ void NetworkProgrammer::check_connection() {
 		throw Exception("Not connected to a target.");
 }
 
+// Send the prepared frame. Returns time to wait for a reply.
+std::chrono::steady_clock::duration NetworkProgrammer::transmit(int attempt) {
+	using std::chrono::milliseconds;
+
+	auto frame = _tx_buf.data();
+
+	// Payload of the previous reply is no longer needed
+	if (!attempt) {
+		_rx_buf.release();
+		_pending.clear();
+	}
+
+	if (_mux)
+		_mux->send(frame, _tx_address);
+	else
+		_socket->sendto(frame, 0, &_tx_address, sizeof(_tx_address));
+	_pacer.sent(frame.size_bytes());
+	_stats.tx_frames++;
+	_stats.tx_bytes += frame.size_bytes();
+	if (attempt)
+		_stats.retransmissions++;
+
+	// A retransmission gets a new seq, so the target executes it again. Only requests which don't change
+	// the flash are retransmitted early, when replies usually come fast. Back off on each attempt.
+	if (!Protocol::is_idempotent(static_cast<Protocol::Operation>(_tx_buf.get_operation())))
+		return milliseconds(TIMEOUT);
+
+	auto wait_time = _pacer.timeout(milliseconds(TIMEOUT)) * (1 << attempt);
+	if ((attempt == ATTEMPTS - 1) || (wait_time > milliseconds(TIMEOUT)))
+		wait_time = milliseconds(TIMEOUT);
+
+	return wait_time;
+}
+
+// Process received frame, measure round trip time and extend the deadline of a busy target
+NetworkProgrammer::Result NetworkProgrammer::receive(int attempt, std::chrono::steady_clock::time_point sent,
+													 bool& replied, std::chrono::steady_clock::time_point& deadline) {
+	using std::chrono::steady_clock;
+	using std::chrono::milliseconds;
+
+	const auto status = process();
+
+	// Only replies to the first transmission give an unambiguous round trip time
+	if ((status != Result::Ignore) && !replied) {
+		replied = true;
+		if (!attempt)
+			_pacer.delivered(steady_clock::now() - sent);
+	}
+
+	// The target is executing the request. Each transmission gets a new seq, so a retransmission would
+	// execute it again, postpone it until BUSY_TIMEOUT. With CAP_QUIET_ACK only slow operations are acknowledged.
+	if (status == Result::ExtendTime)
+		deadline = steady_clock::now() + milliseconds(BUSY_TIMEOUT);
+
+	return status;
+}
+
 // Send frame and wait for reply
 void NetworkProgrammer::communicate() {
 	using std::chrono::steady_clock;
-	using std::chrono::milliseconds;
 	using std::chrono::duration_cast;
 	using std::chrono::duration;
 
-	for (int i = 0; i < 3; i++) {
-		_socket.sendto(_tx_buf.data(), 0, &_tx_address, sizeof(_tx_address));
+	if (_mux)
+		throw Exception("Programmers on a shared socket support only asynchronous operations.");
+
+	for (int i = 0; i < ATTEMPTS; i++) {
+		_pacer.wait();
+		const auto sent = steady_clock::now();
+		auto deadline = sent + transmit(i);
+		auto now = sent;
+		bool replied = false;
 
-		auto now = steady_clock::now();
-		auto deadline = now + milliseconds(TIMEOUT);
 		for (; deadline > now; now = steady_clock::now()) {
 			int timeout = duration_cast<duration<int, std::milli>>(deadline - now).count();
 			int ret = Network::poll(_poll, timeout);
 
-			if (ret && (_poll[0].revents & POLLIN)) {
-				auto status = process();
-				switch (status) {
-					case Result::Ignore:
-					case Result::ExtendTime:
-						// Write operation needs 2.8ms to complete. Extending a timeout seems not necessery.
-						break;
-					case Result::Done:
-						return;
-				}
-			}
+			if (ret && (_poll[0].revents & POLLIN))
+				if (receive(i, sent, replied, deadline) == Result::Done)
+					return;
+		}
+
+		_pacer.lost();
+	}
+
+	throw Exception("The target did not respond within the specified time.");
+}
+
+// Send frame and wait for reply without blocking the reactor
+Task<> NetworkProgrammer::communicate_async(Reactor& reactor) {
+	using std::chrono::steady_clock;
+
+	for (int i = 0; i < ATTEMPTS; i++) {
+		while (!_pacer.ready())
+			co_await reactor.sleep_until(_pacer.next());
+
+		const auto sent = steady_clock::now();
+		auto deadline = sent + transmit(i);
+		bool replied = false;
+
+		for (;;) {
+			if (_mux) {
+				if (_pending.empty() && !co_await reactor.wait(_received, deadline))
+					break;
+				if (_pending.empty())
+					continue;
+			} else if (!co_await reactor.readable(*_socket, deadline))
+				break;
+
+			if (receive(i, sent, replied, deadline) == Result::Done)
+				co_return;
 		}
+
+		_pacer.lost();
 	}
 
 	throw Exception("The target did not respond within the specified time.");
@@ -251,12 +491,23 @@ void NetworkProgrammer::communicate() {
 // Process received frame
 NetworkProgrammer::Result NetworkProgrammer::process() {
 	int rx_address_size = sizeof(_rx_address);
+	int size;
+
+	if (_mux) {
+		auto& [buffer, length] = _pending.front();
+		size = static_cast<int>(length);
+		_rx_buf.assign(std::move(buffer), length);
+		_rx_address = _tx_address;
+		_pending.pop_front();
+	} else
+		size = _socket->recvfrom(_rx_buf.acquire(), 0, &_rx_address, &rx_address_size);
 
-	const int size = _socket.recvfrom(_rx_buf, 0, &_rx_address, &rx_address_size);
 	if (size < sizeof(Protocol::ReplyHeader))
 		throw Exception("A truncated frame was received.");
 
 	_rx_buf.set_content_length(size);
+	_stats.rx_frames++;
+	_stats.rx_bytes += size;
 
 	if (_rx_buf.get_version() != Protocol::VERSION)
 		throw Exception("Unsupported protocol version.");
@@ -281,6 +532,7 @@ NetworkProgrammer::Result NetworkProgrammer::process() {
 		case Protocol::STATUS_DONE:
 			if ((operation != Protocol::OP_READ) &&
 				(operation != Protocol::OP_WRITE) &&
+				(operation != Protocol::OP_WRITE_PACKED) &&
 				(operation != Protocol::OP_ERASE) &&
 				(operation != Protocol::OP_CHECKSUM))
 				throw Exception("Received unexcepted status from target.");
@@ -293,7 +545,10 @@ NetworkProgrammer::Result NetworkProgrammer::process() {
 				(operation != Protocol::OP_ERASE) &&
 				(operation != Protocol::OP_ERASE_WRITE) &&
 				(operation != Protocol::OP_CHIP_ERASE) &&
-				(operation != Protocol::OP_CHECKSUM))
+				(operation != Protocol::OP_CHECKSUM) &&
+				(operation != Protocol::OP_CHECKSUM_PAGES) &&
+				(operation != Protocol::OP_BLANK_CHECK) &&
+				(operation != Protocol::OP_COMPOUND))
 				throw Exception("Received unexcepted status from target.");
 
 			return Result::ExtendTime;
@@ -307,15 +562,22 @@ NetworkProgrammer::Result NetworkProgrammer::process() {
 
 // Process DiscoverReply from target
 void NetworkProgrammer::process_discover(Protocol::Operation op) {
+	// Programmers on a shared socket have none, communicate() rejects them
 	try {
 		communicate();
 	}
 	catch (...) {
-		_socket.set_broadcast(false);
+		if (_socket)
+			_socket->set_broadcast(false);
 		throw;
 	}
+	_socket->set_broadcast(false);
+	discovered(op);
+}
+
+// Store target information from a received DiscoverReply
+void NetworkProgrammer::discovered(Protocol::Operation op) {
 	_tx_address = _rx_address;
-	_socket.set_broadcast(false);
 
 	char addr[INET_ADDRSTRLEN] = {};
 	inet_ntop(_rx_address.sin_family, &_rx_address.sin_addr, addr, sizeof(addr));
@@ -325,20 +587,58 @@ void NetworkProgrammer::process_discover(Protocol::Operation op) {
 	_bootloader.address = info->bootloader_address;
 	_bootloader.version = info->version;
 	_bootloader.device_id = info->device_id;
+	parse_profile(op);
+	_queued.clear();
 
 	printf("Device ID.........: %04X\n", _bootloader.device_id);
 	printf("Bootloader version: %u.%02u\n", _bootloader.version >> 8, _bootloader.version & 0xff);
 	printf("Bootloader address: 0x%06X\n", _bootloader.address);
+	printf("Capabilities......: %08X\n", _profile.capabilities);
+	printf("Max request/reply.: %u/%u\n", _profile.max_request, _profile.max_reply);
+	printf("Window............: %u\n", _profile.window);
 
 	_dev_desc = DeviceDescriptor::find(_bootloader.device_id);
 	printf("Device............: %s rev. %u\n", _dev_desc->name.c_str(), DeviceDescriptor::get_revision(_bootloader.device_id));
 }
 
+// Build session profile from DiscoverReply
+void NetworkProgrammer::parse_profile(Protocol::Operation op) {
+	// Defaults of targets without DiscoverReplyExt
+	_profile.capabilities = LEGACY_CAPABILITIES & _capabilities;
+	_profile.max_request = sizeof(Protocol::RequestHeader) + sizeof(Protocol::Write);
+	_profile.max_reply = ReceiveBuffer::BUFFER_SIZE;
+	_profile.window = 1;
+	_profile.checksum = Protocol::CHECKSUM_UNKNOWN;
+
+	if (_rx_buf.get_payload(op).size_bytes() >= sizeof(Protocol::DiscoverReplyExt)) {
+		auto ext = _rx_buf.get_payload<Protocol::DiscoverReplyExt>(op);
+		_profile.capabilities = ext->capabilities & _capabilities;
+		_profile.max_request = static_cast<uint16_t>(std::min<size_t>(ext->max_request, Protocol::MAX_FRAME));
+		_profile.max_reply = static_cast<uint16_t>(std::min<size_t>(ext->max_reply, ReceiveBuffer::BUFFER_SIZE));
+		_profile.window = std::max<uint8_t>(ext->window, 1);
+		_profile.checksum = static_cast<Protocol::ChecksumAlgorithm>(ext->checksum);
+	}
+
+	// A checksum of an unknown algorithm can't be compared, the memory is read instead
+	if (_profile.checksum != Protocol::CHECKSUM_FLETCHER32)
+		_profile.capabilities &= ~(Protocol::CAP_CHECKSUM | Protocol::CAP_CHECKSUM_PAGES);
+
+	if (_profile.max_request < sizeof(Protocol::RequestHeader) + sizeof(Protocol::Write))
+		throw Exception("The target reported too small request size.");
+
+	if (_profile.max_reply <= sizeof(Protocol::ReplyHeader))
+		throw Exception("The target reported too small reply size.");
+
+	_descriptor.max_read = _profile.max_reply - sizeof(Protocol::ReplyHeader);
+	_pacer.set_buffer_size(static_cast<size_t>(_profile.window) * _profile.max_request);
+}
+
 // Discover device on network
 void NetworkProgrammer::discover_device(uint16_t port) {
 	set_address(INADDR_BROADCAST, port);
 
-	_tx_buf.select_operation(Protocol::OP_DISCOVER);
+	auto discover = _tx_buf.prepare_payload<Protocol::Discover>();
+	discover->capabilities = _capabilities;
 
 	process_discover();
 }
@@ -351,6 +651,7 @@ void NetworkProgrammer::configure_device(uint32_t ip_address, uint16_t port) {
 
 	auto conf = _tx_buf.prepare_payload<Protocol::NetworkConfig>();
 	conf->ip_address = ip_address;
+	conf->capabilities = _capabilities;
 	std::memcpy(&conf->mac_address, mac, sizeof(mac));
 #if 0
 	conf->mac_address_eth[0] = mac[4];
@@ -374,7 +675,8 @@ void NetworkProgrammer::configure_device(uint32_t ip_address, uint16_t port) {
 void NetworkProgrammer::connect_device(uint32_t ip_address, uint16_t port) {
 	set_address(ip_address, port);
 
-	_tx_buf.select_operation(Protocol::OP_DISCOVER);
+	auto discover = _tx_buf.prepare_payload<Protocol::Discover>();
+	discover->capabilities = _capabilities;
 
 	try {
 		process_discover();
@@ -388,6 +690,7 @@ void NetworkProgrammer::connect_device(uint32_t ip_address, uint16_t port) {
 // Read a device's memory
 std::span<const std::byte> NetworkProgrammer::read(uint32_t address, size_t size) {
 	check_connection();
+	flush();
 
 	_tx_buf.select_operation(Protocol::OP_READ, address, static_cast<uint16_t>(size));
 
@@ -398,32 +701,109 @@ std::span<const std::byte> NetworkProgrammer::read(uint32_t address, size_t size
 // Write a device's memory
 void NetworkProgrammer::write(uint32_t address, const std::span<const std::byte>& buffer) {
 	check_connection();
-	
-		//_tx_buf.select_operation(Protocol::OP_WRITE, address, buffer.size_bytes());
-	auto write = _tx_buf.prepare_payload<Protocol::Write>();
-	write->address = address;
-	std::memcpy(write->data, buffer.data(), sizeof(write->data));
+	flush();
 
+	prepare_write(address, buffer);
 	communicate();
 }
 
+// Prepare a write request
+void NetworkProgrammer::prepare_write(uint32_t address, std::span<const std::byte> buffer) {
+	const auto data = sector(buffer);
+	std::array<std::byte, sizeof(Protocol::Write)> packed;
+	const size_t packed_size = pack(buffer, packed);
+	count_write(data.size(), packed_size ? packed_size : sizeof(Protocol::Write));
+
+	if (packed_size) {
+		auto payload = _tx_buf.prepare_payload(Protocol::OP_WRITE_PACKED, packed_size, address, static_cast<uint16_t>(packed_size));
+		std::memcpy(payload.data(), packed.data(), packed_size);
+	} else {
+		auto write = _tx_buf.prepare_payload<Protocol::Write>(address, static_cast<uint16_t>(buffer.size_bytes()));
+		write->address = address;
+		std::memcpy(write->data, data.data(), sizeof(write->data));
+	}
+}
+
+// Copy write data into a sector, padding it with erased bytes
+std::array<std::byte, sizeof(Protocol::Write::data)> NetworkProgrammer::sector(std::span<const std::byte> buffer) {
+	std::array<std::byte, sizeof(Protocol::Write::data)> data;
+
+	data.fill(std::byte(0xFF));
+	std::memcpy(data.data(), buffer.data(), std::min(buffer.size_bytes(), data.size()));
+	return data;
+}
+
+// Encode write data if the target supports it and it pays off. Returns size of packed data or 0.
+size_t NetworkProgrammer::pack(std::span<const std::byte> data, std::span<std::byte> output) const {
+	// Partial sectors are sent as they are, to let the target validate them
+	if (!_profile.supports(Protocol::CAP_PACKED_WRITE) || (data.size_bytes() != sizeof(Protocol::Write::data)))
+		return 0;
+
+	// Encoder fails if the result wouldn't save enough
+	return PackBits::encode(data, output.first(MAX_PACKED_SIZE));
+}
+
+void NetworkProgrammer::count_write(size_t size, size_t payload_size) {
+	_stats.write_bytes += size;
+	_stats.write_payload_bytes += payload_size;
+}
+
 // Erase a device's memory
 void NetworkProgrammer::erase(uint32_t address) {
 	check_connection();
+	flush();
 
 	_tx_buf.select_operation(Protocol::OP_ERASE, address);
 	communicate();
 }
 
+// Erase sector and write it
+void NetworkProgrammer::erase_write(uint32_t address, const std::span<const std::byte>& buffer) {
+	check_connection();
+
+	// Without OP_ERASE_WRITE, a compound request still needs a single round trip
+	if (!_profile.supports(Protocol::CAP_ERASE_WRITE)) {
+		queue_erase(address);
+		queue_write(address, buffer);
+		return flush();
+	}
+
+	flush();
+	auto write = _tx_buf.prepare_payload<Protocol::EraseWrite>(address);
+	write->address = address;
+	std::memcpy(write->data, buffer.data(), sizeof(write->data));
+
+	communicate();
+}
+
+// Erase whole device memory
+void NetworkProgrammer::chip_erase() {
+	check_connection();
+
+	if (!_profile.supports(Protocol::CAP_CHIP_ERASE))
+		return IProgrammerStrategy::chip_erase();
+
+	flush();
+	_tx_buf.select_operation(Protocol::OP_CHIP_ERASE);
+	communicate();
+}
+
 // Reset a device
 void NetworkProgrammer::reset() {
 	check_connection();
+	flush();
 	_tx_buf.select_operation(Protocol::OP_RESET);
 	communicate();
 }
 
 // Calculate a checksum of a device's memory
 uint32_t NetworkProgrammer::checksum(uint32_t address, size_t size) {
+	check_connection();
+	flush();
+
+	if (!_profile.supports(Protocol::CAP_CHECKSUM))
+		return IProgrammerStrategy::checksum(address, size);
+
 	_tx_buf.select_operation(Protocol::OP_CHECKSUM, address, size);
 	communicate();
 
@@ -431,6 +811,269 @@ uint32_t NetworkProgrammer::checksum(uint32_t address, size_t size) {
 	return result->checksum;
 }
 
+// Calculate a checksum of each erase page in a range
+std::vector<uint32_t> NetworkProgrammer::checksum_pages(uint32_t address, size_t pages) {
+	const size_t max_pages = _descriptor.max_read / sizeof(Protocol::be32_t);
+	std::vector<uint32_t> result;
+
+	check_connection();
+	flush();
+
+	// Fall back to a checksum of each page
+	if (!_profile.supports(Protocol::CAP_CHECKSUM_PAGES))
+		return IProgrammerStrategy::checksum_pages(address, pages);
+	result.reserve(pages);
+
+	while (pages) {
+		const size_t count = std::min(pages, max_pages);
+
+		_tx_buf.select_operation(Protocol::OP_CHECKSUM_PAGES, address, static_cast<uint16_t>(count));
+		communicate();
+
+		auto payload = _rx_buf.get_payload(Protocol::OP_CHECKSUM_PAGES);
+		if (payload.size_bytes() != count * sizeof(Protocol::be32_t))
+			throw Exception("Invalid size of the checksum reply.");
+
+		auto reply = reinterpret_cast<const Protocol::ChecksumPagesReply*>(payload.data());
+		for (size_t i = 0; i < count; i++)
+			result.push_back(reply->checksum[i]);
+
+		pages -= count;
+		address += static_cast<uint32_t>(count * DeviceDescriptor::ERASE_SIZE);
+	}
+
+	return result;
+}
+
+// Check which erase pages in a range are blank
+std::vector<bool> NetworkProgrammer::blank_check(uint32_t address, size_t pages) {
+	const size_t max_pages = std::min<size_t>(_descriptor.max_read * 8, UINT16_MAX);
+	std::vector<bool> result;
+
+	check_connection();
+	flush();
+
+	if (!_profile.supports(Protocol::CAP_BLANK_CHECK))
+		return IProgrammerStrategy::blank_check(address, pages);
+	result.reserve(pages);
+
+	while (pages) {
+		const size_t count = std::min(pages, max_pages);
+
+		_tx_buf.select_operation(Protocol::OP_BLANK_CHECK, address, static_cast<uint16_t>(count));
+		communicate();
+
+		auto payload = _rx_buf.get_payload(Protocol::OP_BLANK_CHECK);
+		if (payload.size_bytes() != (count + 7) / 8)
+			throw Exception("Invalid size of the blank check reply.");
+
+		auto reply = reinterpret_cast<const Protocol::BlankCheckReply*>(payload.data());
+		for (size_t i = 0; i < count; i++)
+			result.push_back(reply->bitmap[i / 8] & (1 << (i % 8)));
+
+		pages -= count;
+		address += static_cast<uint32_t>(count * DeviceDescriptor::ERASE_SIZE);
+	}
+
+	return result;
+}
+
+// Check which erase pages in a range were completely received from a stream session
+std::vector<bool> NetworkProgrammer::stream_status(uint32_t address, size_t pages, uint16_t session) {
+	const size_t max_pages = std::min<size_t>((_descriptor.max_read - sizeof(Protocol::be16_t)) * 8, UINT16_MAX);
+	std::vector<bool> result;
+
+	check_connection();
+	flush();
+
+	if (!_profile.supports(Protocol::CAP_STREAM))
+		throw Exception("Operation is not supported.");
+	result.reserve(pages);
+
+	while (pages) {
+		const size_t count = std::min(pages, max_pages);
+
+		auto request = _tx_buf.prepare_payload<Protocol::StreamStatus>(address, static_cast<uint16_t>(count));
+		request->session = session;
+		communicate();
+
+		auto payload = _rx_buf.get_payload(Protocol::OP_STREAM_STATUS);
+		if (payload.size_bytes() != sizeof(Protocol::be16_t) + (count + 7) / 8)
+			throw Exception("Invalid size of the stream status reply.");
+
+		auto reply = reinterpret_cast<const Protocol::StreamStatusReply*>(payload.data());
+		for (size_t i = 0; i < count; i++)
+			result.push_back((reply->session == session) && (reply->bitmap[i / 8] & (1 << (i % 8))));
+
+		pages -= count;
+		address += static_cast<uint32_t>(count * DeviceDescriptor::ERASE_SIZE);
+	}
+
+	return result;
+}
+
+// Queue erase of a device's memory
+void NetworkProgrammer::queue_erase(uint32_t address) {
+	check_connection();
+
+	if (!_profile.supports(Protocol::CAP_COMPOUND))
+		return erase(address);
+
+	queue_operation(Protocol::OP_ERASE, address, 0);
+}
+
+// Queue write of a device's memory
+void NetworkProgrammer::queue_write(uint32_t address, const std::span<const std::byte>& buffer) {
+	check_connection();
+
+	if (!_profile.supports(Protocol::CAP_COMPOUND))
+		return write(address, buffer);
+
+	const auto data = sector(buffer);
+	std::array<std::byte, sizeof(Protocol::Write)> packed;
+	const size_t packed_size = pack(buffer, packed);
+	count_write(data.size(), packed_size ? packed_size : sizeof(Protocol::Write));
+
+	if (packed_size) {
+		auto header = queue_operation(Protocol::OP_WRITE_PACKED, address, packed_size);
+		header->length = static_cast<uint16_t>(packed_size);
+		std::memcpy(header + 1, packed.data(), packed_size);
+	} else {
+		auto header = queue_operation(Protocol::OP_WRITE, address, sizeof(Protocol::Write));
+		header->length = static_cast<uint16_t>(buffer.size_bytes());
+		auto write = reinterpret_cast<Protocol::Write*>(header + 1);
+		write->address = address;
+		std::memcpy(write->data, data.data(), sizeof(write->data));
+	}
+}
+
+// Append an operation to the pending compound request, sending it first if it is full
+Protocol::RequestHeader* NetworkProgrammer::queue_operation(Protocol::Operation op, uint32_t address, size_t payload_size) {
+	const size_t limit = _profile.max_request;
+
+	if (_queued.empty())
+		_tx_buf.begin_compound();
+
+	auto header = _tx_buf.append(op, address, payload_size, limit);
+	if (!header) {
+		flush();
+		_tx_buf.begin_compound();
+		header = _tx_buf.append(op, address, payload_size, limit);
+		if (!header)
+			throw Exception("Operation doesn't fit into the target's request size.");
+	}
+
+	_queued.push_back(address);
+	return header;
+}
+
+// Send pending compound request
+void NetworkProgrammer::flush() {
+	if (_queued.empty())
+		return;
+
+	const auto queued = std::move(_queued);
+	_queued.clear();
+
+	communicate();
+	check_compound(queued);
+}
+
+// Check statuses of a compound reply
+void NetworkProgrammer::check_compound(const std::vector<uint32_t>& queued) {
+	auto payload = _rx_buf.get_payload(Protocol::OP_COMPOUND);
+	if (payload.size_bytes() != queued.size())
+		throw Exception("Invalid size of the compound reply.");
+
+	auto reply = reinterpret_cast<const Protocol::CompoundReply*>(payload.data());
+	for (size_t i = 0; i < queued.size(); i++) {
+		const auto status = static_cast<Protocol::Status>(static_cast<uint8_t>(reply->status[i]));
+		if (status != Protocol::STATUS_OK) {
+			ETarget err(status);
+			err.prepend("Operation {} of {} at address {:#06X} failed.", i + 1, queued.size(), queued[i]);
+			throw err;
+		}
+	}
+}
+
+// Select device without blocking the reactor
+Task<> NetworkProgrammer::connect_device_async(Reactor& reactor, uint32_t ip_address, uint16_t port) {
+	set_address(ip_address, port);
+
+	auto discover = _tx_buf.prepare_payload<Protocol::Discover>();
+	discover->capabilities = _capabilities;
+
+	try {
+		co_await communicate_async(reactor);
+		discovered(Protocol::OP_DISCOVER);
+	}
+	catch (Exception& err) {
+		err.prepend("Unable to connect to a target.");
+		throw;
+	}
+}
+
+// Read a device's memory without blocking the reactor
+Task<std::span<const std::byte>> NetworkProgrammer::read_async(Reactor& reactor, uint32_t address, size_t size) {
+	check_connection();
+	co_await flush_async(reactor);
+
+	if (size > _descriptor.max_read)
+		throw Exception("Read size exceeds limit.");
+
+	_tx_buf.select_operation(Protocol::OP_READ, address, static_cast<uint16_t>(size));
+	co_await communicate_async(reactor);
+	co_return _rx_buf.get_payload(Protocol::OP_READ);
+}
+
+// Write a device's memory without blocking the reactor
+Task<> NetworkProgrammer::write_async(Reactor& reactor, uint32_t address, std::span<const std::byte> buffer) {
+	check_connection();
+	co_await flush_async(reactor);
+
+	if (buffer.size_bytes() > _descriptor.max_write)
+		throw Exception("Size is beyond the capabilities of the programmer.");
+
+	prepare_write(address, buffer);
+	co_await communicate_async(reactor);
+}
+
+// Erase a device's memory without blocking the reactor
+Task<> NetworkProgrammer::erase_async(Reactor& reactor, uint32_t address) {
+	check_connection();
+	co_await flush_async(reactor);
+
+	_tx_buf.select_operation(Protocol::OP_ERASE, address);
+	co_await communicate_async(reactor);
+}
+
+// Calculate a checksum of a device's memory without blocking the reactor
+Task<uint32_t> NetworkProgrammer::checksum_async(Reactor& reactor, uint32_t address, size_t size) {
+	check_connection();
+	co_await flush_async(reactor);
+
+	if (!_profile.supports(Protocol::CAP_CHECKSUM))
+		throw Exception("Operation is not supported.");
+
+	_tx_buf.select_operation(Protocol::OP_CHECKSUM, address, static_cast<uint16_t>(size));
+	co_await communicate_async(reactor);
+
+	auto result = _rx_buf.get_payload<Protocol::ChecksumReply>(Protocol::OP_CHECKSUM);
+	co_return result->checksum;
+}
+
+// Send pending compound request without blocking the reactor
+Task<> NetworkProgrammer::flush_async(Reactor& reactor) {
+	if (_queued.empty())
+		co_return;
+
+	const auto queued = std::move(_queued);
+	_queued.clear();
+
+	co_await communicate_async(reactor);
+	check_compound(queued);
+}
+
 /* TransmitBuffer */
 
 NetworkProgrammer::TransmitBuffer::TransmitBuffer() 
@@ -450,6 +1093,42 @@ void NetworkProgrammer::TransmitBuffer::select_operation(Protocol::Operation op,
 	_size = sizeof(Protocol::RequestHeader);
 }
 
+// Select operation with a payload of given size
+std::span<std::byte> NetworkProgrammer::TransmitBuffer::prepare_payload(Protocol::Operation op, size_t size,
+																		 uint32_t address, uint16_t length) {
+	if (sizeof(Protocol::RequestHeader) + size > _buffer.size())
+		throw Exception("Tx buffer too small.");
+
+	select_operation(op, address, length);
+	_size = sizeof(Protocol::RequestHeader) + size;
+	return std::span(_buffer).subspan(sizeof(Protocol::RequestHeader), size);
+}
+
+// Start an empty compound request
+void NetworkProgrammer::TransmitBuffer::begin_compound() {
+	select_operation(Protocol::OP_COMPOUND);
+}
+
+// Append an operation to the compound request. Returns nullptr if the request would exceed the limit.
+Protocol::RequestHeader* NetworkProgrammer::TransmitBuffer::append(Protocol::Operation op, uint32_t address,
+																   size_t payload_size, size_t limit) {
+	const size_t size = _size + sizeof(Protocol::RequestHeader) + payload_size;
+	if ((size > limit) || (size > _buffer.size()))
+		return nullptr;
+
+	auto item = reinterpret_cast<Protocol::RequestHeader*>(&_buffer[_size]);
+	item->version = Protocol::VERSION;
+	item->seq = 0;
+	item->operation = op;
+	item->status = Protocol::STATUS_REQUEST;
+	item->address = address;
+	item->length = 0;
+
+	get_header()->length = get_header()->length + 1;
+	_size = size;
+	return item;
+}
+
 Protocol::RequestHeader* NetworkProgrammer::TransmitBuffer::get_header() {
 	static_assert(std::tuple_size<decltype(_buffer)>::value >= sizeof(Protocol::RequestHeader), "Tx buffer too small");
 	return reinterpret_cast<Protocol::RequestHeader*>(_buffer.data());
@@ -469,12 +1148,33 @@ const std::span<const std::byte> NetworkProgrammer::TransmitBuffer::data() {
 
 const Protocol::ReplyHeader* NetworkProgrammer::ReceiveBuffer::get_header() const {
 	// TODO: assert(_size >= sizeof(Protocol::ReplyHeader), "Rx buffer too small");
-	return reinterpret_cast<const Protocol::ReplyHeader*>(_buffer.data());
+	return reinterpret_cast<const Protocol::ReplyHeader*>(_buffer->data());
+}
+
+// Get span of an empty buffer from the pool
+std::span<std::byte> NetworkProgrammer::ReceiveBuffer::acquire() {
+	if (!_buffer)
+		_buffer = BufferPool::shared().acquire();
+
+	_size = 0;
+	return *_buffer;
+}
+
+// Take a buffer with a received frame
+void NetworkProgrammer::ReceiveBuffer::assign(BufferPool::Buffer&& buffer, size_t size) {
+	_buffer = std::move(buffer);
+	set_content_length(size);
+}
+
+// Return the buffer to the pool. Invalidates the received payload.
+void NetworkProgrammer::ReceiveBuffer::release() {
+	_buffer.reset();
+	_size = 0;
 }
 
 // Set length of a data in the buffer
 void NetworkProgrammer::ReceiveBuffer::set_content_length(size_t size) {
-	assert(size <= _buffer.size());
+	assert(size <= _buffer->size());
 	_size = size;
 }
 
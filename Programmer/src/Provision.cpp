@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Copyright(c) 2023 Koko Software. All rights reserved.
+//
+// Author: Adrian Warecki <embedded@kokosoftware.pl>
+
+#include <stdio.h>
+#include <cstring>
+#include <algorithm>
+
+#include <Programmer/Pacer.hpp>
+#include <Programmer/Provision.hpp>
+
+namespace programmer {
+
+Provisioner::Provisioner(uint32_t first_address, uint32_t last_address, uint32_t capabilities)
+	: _capabilities(capabilities), _next_address(Network::ntohl()(first_address)),
+	_last_address(Network::ntohl()(last_address)), _seq(0), _errors(0)
+{
+}
+
+// Add a board to the batch and assign it the next address from the pool
+void Provisioner::add_board(const MacAddress& mac) {
+	auto known = std::find_if(_assignments.begin(), _assignments.end(), [&mac](const Assignment& assignment) {
+		return assignment.mac == mac;
+	});
+	if (known != _assignments.end())
+		throw Exception("Board {:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X} added twice.",
+						mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+	if (_next_address > _last_address)
+		throw Exception("Address pool exhausted.");
+
+	_assignments.push_back({ mac, Network::htonl()(_next_address++), false, {} });
+}
+
+void Provisioner::prepare_request(Request& request, const Assignment& assignment, uint8_t seq) const {
+	auto header = reinterpret_cast<Protocol::RequestHeader*>(request.data());
+	header->version = Protocol::VERSION;
+	header->seq = seq;
+	header->operation = Protocol::OP_NET_CONFIG;
+	header->status = Protocol::STATUS_REQUEST;
+	header->address = 0;
+	header->length = 0;
+
+	auto conf = reinterpret_cast<Protocol::NetworkConfig*>(request.data() + sizeof(Protocol::RequestHeader));
+	std::memcpy(conf->mac_address, assignment.mac.data(), assignment.mac.size());
+	conf->ip_address = assignment.ip_address;
+	conf->capabilities = _capabilities;
+}
+
+// Receive pending replies, confirming the matching assignments
+void Provisioner::receive(SocketUDP& socket, const std::vector<Assignment*>& batch, uint8_t first_seq) {
+	std::array<std::byte, Protocol::MAX_FRAME> buffer;
+
+	for (;;) {
+		sockaddr_in address;
+		int address_size = sizeof(address);
+
+		const int size = socket.recvfrom(buffer, 0, &address, &address_size);
+		if (size < 0)
+			break;
+
+		if (size < sizeof(Protocol::ReplyHeader) + sizeof(Protocol::DiscoverReply))
+			continue;
+
+		auto header = reinterpret_cast<const Protocol::ReplyHeader*>(buffer.data());
+		const uint8_t index = static_cast<uint8_t>(header->seq - first_seq);
+		if ((header->version != Protocol::VERSION) || (header->operation != Protocol::OP_NET_CONFIG) ||
+			(header->status != Protocol::STATUS_OK) || (index >= batch.size()))
+			continue;
+
+		Assignment& assignment = *batch[index];
+		if (assignment.confirmed)
+			continue;
+
+		// A stray reply of another board must not confirm the assignment
+		if (address.sin_addr.s_addr != assignment.ip_address) {
+			_errors++;
+			continue;
+		}
+
+		auto info = reinterpret_cast<const Protocol::DiscoverReply*>(buffer.data() + sizeof(Protocol::ReplyHeader));
+		assignment.target = { address, INADDR_ANY, info->device_id, info->version, info->bootloader_address, 0 };
+		if (size >= sizeof(Protocol::ReplyHeader) + sizeof(Protocol::DiscoverReplyExt))
+			assignment.target.capabilities = reinterpret_cast<const Protocol::DiscoverReplyExt*>(info)->capabilities;
+		assignment.confirmed = true;
+	}
+}
+
+// Send configuration to each board of the batch and collect replies until the window passes
+void Provisioner::round(SocketUDP& socket, const std::vector<Assignment*>& batch, uint16_t port,
+						clock::duration window, double rate) {
+	std::array<struct pollfd, 1> fds{ { socket, POLLIN, 0 } };
+	sockaddr_in broadcast{ AF_INET, Network::htons()(port) };
+	broadcast.sin_addr.s_addr = INADDR_BROADCAST;
+
+	Request request{};
+	const double frame_rate = rate * request.size();
+	Pacer pacer(frame_rate, frame_rate, frame_rate, BURST * request.size());
+
+	// Replies are matched by the offset of their sequence number from the first request of the round
+	const uint8_t first_seq = static_cast<uint8_t>(_seq + 1);
+	_seq = static_cast<uint8_t>(_seq + batch.size());
+
+	size_t next = 0;
+	auto deadline = clock::time_point::max();
+
+	for (;;) {
+		while ((next < batch.size()) && pacer.ready()) {
+			prepare_request(request, *batch[next], static_cast<uint8_t>(first_seq + next));
+			socket.sendto(request, 0, &broadcast, sizeof(broadcast));
+			pacer.sent(request.size());
+
+			if (++next == batch.size())
+				deadline = clock::now() + window;
+		}
+
+		const auto now = clock::now();
+		if (now >= deadline)
+			break;
+
+		// All boards confirmed, no need to wait for the window
+		if ((next == batch.size()) &&
+			std::all_of(batch.begin(), batch.end(), [](const Assignment* a) { return a->confirmed; }))
+			break;
+
+		const auto wake = (next < batch.size()) ? pacer.next() : deadline;
+		Network::poll(fds, wake);
+
+		if (fds[0].revents & POLLIN)
+			receive(socket, batch, first_seq);
+	}
+}
+
+// Configure all boards which haven't confirmed their assignment yet
+size_t Provisioner::provision(uint16_t port, clock::duration window, double rate) {
+	SocketUDP socket;
+	socket.set_broadcast(true);
+	socket.receive_broadcast(false);
+	socket.set_nonblocking(true);
+
+	for (int attempt = 0; attempt < ATTEMPTS; attempt++) {
+		std::vector<Assignment*> pending;
+		for (Assignment& assignment : _assignments)
+			if (!assignment.confirmed)
+				pending.push_back(&assignment);
+
+		if (pending.empty())
+			break;
+
+		for (size_t i = 0; i < pending.size(); i += MAX_BATCH) {
+			const auto end = pending.begin() + std::min(i + MAX_BATCH, pending.size());
+			round(socket, std::vector<Assignment*>(pending.begin() + i, end), port, window, rate);
+		}
+	}
+
+	return std::count_if(_assignments.begin(), _assignments.end(), [](const Assignment& a) { return a.confirmed; });
+}
+
+void Provisioner::print() const {
+	for (const Assignment& assignment : _assignments) {
+		char ip[INET_ADDRSTRLEN] = {};
+		inet_ntop(AF_INET, &assignment.ip_address, ip, sizeof(ip));
+
+		printf("%02X:%02X:%02X:%02X:%02X:%02X -> %-15s ", assignment.mac[0], assignment.mac[1], assignment.mac[2],
+			   assignment.mac[3], assignment.mac[4], assignment.mac[5], ip);
+
+		if (assignment.confirmed)
+			printf("Device ID: %04X Bootloader: %u.%02u\n", assignment.target.device_id,
+				   assignment.target.version >> 8, assignment.target.version & 0xff);
+		else
+			printf("not confirmed\n");
+	}
+}
+
+} // namespace programmer
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Copyright(c) 2023 Koko Software. All rights reserved.
+//
+// Author: Adrian Warecki <embedded@kokosoftware.pl>
+
+#include <algorithm>
+
+#include <Programmer/Proxy.hpp>
+#include <Programmer/protocol.hpp>
+
+namespace programmer {
+
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+// Profiles of the benchmark matrix
+const std::vector<ImpairmentProxy::Profile> ImpairmentProxy::PROFILES = {
+	{ "clean",			0,		microseconds(0),		microseconds(0),		0,		0,		0 },
+	{ "lan",			0,		microseconds(200),		microseconds(100),		0,		0,		12.5e6 },
+	{ "loss 1%",		0.01,	microseconds(200),		microseconds(100),		0,		0,		12.5e6 },
+	{ "loss 5%",		0.05,	microseconds(200),		microseconds(100),		0,		0,		12.5e6 },
+	{ "loss 20%",		0.20,	microseconds(200),		microseconds(100),		0,		0,		12.5e6 },
+	{ "jitter",			0,		microseconds(2000),		microseconds(5000),		0,		0,		12.5e6 },
+	{ "reorder",		0,		microseconds(2000),		microseconds(500),		0.1,	0,		12.5e6 },
+	{ "duplicate",		0,		microseconds(200),		microseconds(100),		0,		0.05,	12.5e6 },
+	{ "wan",			0.01,	microseconds(20000),	microseconds(5000),		0.01,	0.01,	1.25e6 },
+	{ "shop floor",		0.05,	microseconds(5000),		microseconds(20000),	0.05,	0.02,	125e3 },
+};
+
+ImpairmentProxy::ImpairmentProxy(uint16_t listen_port, uint32_t target_address, uint16_t target_port,
+								 const Profile& profile, uint32_t seed)
+	: _profile(profile), _client{}, _target{ AF_INET, Network::htons()(target_port) }, _client_known(false),
+	_link_free{}, _rng(seed), _order(0), _running(false), _stats{}
+{
+	_target.sin_addr.s_addr = target_address;
+
+	sockaddr_in addr{ AF_INET, Network::htons()(listen_port) };
+	addr.sin_addr.s_addr = INADDR_ANY;
+	_client_socket.bind(&addr);
+
+	_client_socket.set_nonblocking(true);
+	_target_socket.set_nonblocking(true);
+
+	// Either side may go away with datagrams still queued for it
+	_client_socket.report_unreachable(false);
+	_target_socket.report_unreachable(false);
+}
+
+// Apply the profile to a datagram and queue it for sending
+void ImpairmentProxy::schedule(std::vector<std::byte>&& data, bool upstream) {
+	std::uniform_real_distribution<double> chance(0, 1);
+
+	if (chance(_rng) < _profile.loss) {
+		_stats.dropped++;
+		return;
+	}
+
+	const int copies = (chance(_rng) < _profile.duplicate) ? 2 : 1;
+	if (copies > 1)
+		_stats.duplicated++;
+
+	for (int i = 0; i < copies; i++) {
+		const auto now = clock::now();
+		auto delay = _profile.latency;
+		if (_profile.jitter.count()) {
+			std::uniform_int_distribution<long long> jitter(-_profile.jitter.count(), _profile.jitter.count());
+			delay = std::max(delay + microseconds(jitter(_rng)), microseconds(0));
+		}
+
+		if (chance(_rng) < _profile.reorder) {
+			delay = microseconds(0);
+			_stats.reordered++;
+		}
+
+		// Datagrams leave the link one after another at the bandwidth
+		auto time = now + delay;
+		if (_profile.bandwidth > 0) {
+			clock::time_point& link_free = _link_free[upstream];
+			time = std::max(time, link_free);
+			link_free = time + std::chrono::duration_cast<clock::duration>(
+				std::chrono::duration<double>(data.size() / _profile.bandwidth));
+		}
+
+		_queue.push({ time, _order++, upstream, (i + 1 < copies) ? data : std::move(data) });
+	}
+}
+
+// Receive all pending datagrams from the socket and schedule them
+void ImpairmentProxy::receive(SocketUDP& socket, bool upstream) {
+	std::array<std::byte, Protocol::MAX_FRAME> buffer;
+
+	for (;;) {
+		sockaddr_in address;
+		int address_size = sizeof(address);
+
+		const int size = socket.recvfrom(buffer, 0, &address, &address_size);
+		if (size < 0)
+			break;
+
+		// Replies go back to the programmer which sent the last request
+		if (upstream) {
+			_client = address;
+			_client_known = true;
+		}
+
+		schedule(std::vector<std::byte>(buffer.begin(), buffer.begin() + size), upstream);
+	}
+}
+
+// Send datagrams which are due. Returns time of the next one.
+ImpairmentProxy::clock::time_point ImpairmentProxy::send() {
+	const auto now = clock::now();
+
+	while (!_queue.empty() && (_queue.top().time <= now)) {
+		const Datagram& datagram = _queue.top();
+		if (datagram.upstream)
+			_target_socket.sendto(datagram.data, 0, &_target, sizeof(_target));
+		else if (_client_known)
+			_client_socket.sendto(datagram.data, 0, &_client, sizeof(_client));
+
+		_stats.forwarded++;
+		_queue.pop();
+	}
+
+	return _queue.empty() ? clock::time_point::max() : _queue.top().time;
+}
+
+// Forward datagrams until stop()
+void ImpairmentProxy::run() {
+	std::array<struct pollfd, 2> fds{ { { _client_socket, POLLIN, 0 }, { _target_socket, POLLIN, 0 } } };
+
+	_running = true;
+	while (_running) {
+		Network::poll(fds, send(), Network::POLL_INTERVAL_MS);
+
+		if (fds[0].revents & POLLIN)
+			receive(_client_socket, true);
+		if (fds[1].revents & POLLIN)
+			receive(_target_socket, false);
+	}
+}
+
+} // namespace programmer
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Copyright(c) 2023 Koko Software. All rights reserved.
+//
+// Author: Adrian Warecki <embedded@kokosoftware.pl>
+
+#include <algorithm>
+#include <cstring>
+
+#include <Programmer/Responder.hpp>
+#include <Programmer/Payload.hpp>
+
+namespace programmer {
+
+TargetNetworkResponder::TargetNetworkResponder(const Config& config, uint16_t port, uint32_t seed)
+	: _config(config), _rng(seed), _running(false), _rx_used(0), _rx_read(0), _rx_write(0), _busy_until{},
+	_last_seq(0), _boot_counter(1), _received_udp(0), _responses(0), _rcon(RCON_POWER_ON), _stats{}
+{
+	sockaddr_in addr{ AF_INET, Network::htons()(port) };
+	addr.sin_addr.s_addr = INADDR_ANY;
+	_socket.bind(&addr);
+	_socket.set_nonblocking(true);
+
+	// Testers come and go, e.g. one per point of FrameSizeBenchmark, with responses still queued
+	_socket.report_unreachable(false);
+}
+
+bool TargetNetworkResponder::chance(double probability) {
+	if (probability <= 0)
+		return false;
+
+	return std::uniform_real_distribution<double>(0, 1)(_rng) < probability;
+}
+
+// Start over like after a watchdog reset
+void TargetNetworkResponder::reboot() {
+	_rx_queue.clear();
+	_rx_used = 0;
+	_rx_read = 0;
+	_rx_write = 0;
+	_responses = 0;
+	_boot_counter++;
+	_rcon = RCON_WATCHDOG;
+}
+
+// Receive all waiting requests into the ring
+void TargetNetworkResponder::receive() {
+	for (;;) {
+		sockaddr_in address;
+		int address_size = sizeof(address);
+
+		const int size = _socket.recvfrom(_buffer, 0, &address, &address_size);
+		if (size < 0)
+			break;
+
+		_stats.rx_frames++;
+		if (chance(_config.rx_loss)) {
+			_stats.lost++;
+			continue;
+		}
+
+		// Frames are stored at even addresses
+		const uint16_t ring_size = static_cast<uint16_t>((RX_OVERHEAD + size + 1) & ~1);
+		if (_rx_used + ring_size > _config.rx_buffer_size) {
+			_stats.overflows++;
+			continue;
+		}
+
+		_rx_queue.push_back({ clock::now(), address, ring_size,
+							  std::vector<std::byte>(_buffer.begin(), _buffer.begin() + size) });
+		_rx_used += ring_size;
+		_rx_write = static_cast<uint16_t>((_rx_write + ring_size) % _config.rx_buffer_size);
+	}
+}
+
+// Handle the oldest request of the ring
+void TargetNetworkResponder::respond() {
+	const Pending request = std::move(_rx_queue.front());
+	_rx_queue.pop_front();
+	_rx_used -= request.ring_size;
+	_rx_read = static_cast<uint16_t>((_rx_read + request.ring_size) % _config.rx_buffer_size);
+
+	// Other traffic is ignored like by the firmware
+	if (request.data.size() < sizeof(Request))
+		return;
+
+	uint32_t seq;
+	std::memcpy(&seq, request.data.data(), sizeof(seq));
+	if (seq & TargetNetworkTester::SEQ_CLEAR) {
+		_boot_counter = 0;
+		_received_udp = 0;
+	}
+	_received_udp++;
+
+	Response response{};
+	response.RCON = _rcon;
+	response.STKPTR = 0;
+	response.ESTAT = ESTAT_READY;
+	response.EPKTCNT = static_cast<uint8_t>(std::min<size_t>(_rx_queue.size(), UINT8_MAX));
+	response.ERXRDPT = _rx_read;
+	response.ERXWRPT = _rx_write;
+	response.last_seq = _last_seq;
+	response.boot_counter = _boot_counter;
+	response.received_udp = _received_udp;
+	response.received_arp = 0;
+	response.cur_seq = seq;
+	_rcon = RCON_RUNNING;
+	_last_seq = seq;
+
+	const size_t max_payload = _config.tx_buffer_size - TargetNetworkTester::TARGET_HEADERS - sizeof(Response);
+	const size_t payload = std::min(request.data.size() - sizeof(Request), max_payload);
+	std::memcpy(_buffer.data(), &response, sizeof(response));
+	TestPayload::echo(std::span(request.data).subspan(sizeof(Request), payload),
+					  std::span(_buffer).subspan(sizeof(response), payload));
+
+	if (chance(_config.tx_loss))
+		_stats.lost++;
+	else {
+		_socket.sendto(std::span(_buffer.data(), sizeof(response) + payload), 0, &request.address, sizeof(request.address));
+		_stats.tx_frames++;
+	}
+
+	if (_config.reboot_interval && (++_responses >= _config.reboot_interval))
+		reboot();
+}
+
+// Handle requests whose processing time passed. Returns time when the next one finishes.
+TargetNetworkResponder::clock::time_point TargetNetworkResponder::process() {
+	const auto frame_time = std::chrono::microseconds(_config.frame_time_us);
+	const auto now = clock::now();
+
+	// A request is handled after the previous one, or when it arrives to an idle target
+	while (!_rx_queue.empty()) {
+		const auto done = std::max(_rx_queue.front().arrival, _busy_until) + frame_time;
+		if (done > now)
+			return done;
+
+		_busy_until = done;
+		respond();
+	}
+
+	return clock::time_point::max();
+}
+
+// Answer requests until stop()
+void TargetNetworkResponder::start() {
+	std::array<struct pollfd, 1> fds{ { { _socket, POLLIN, 0 } } };
+
+	_running = true;
+	while (_running) {
+		Network::poll(fds, process(), Network::POLL_INTERVAL_MS);
+		if (fds[0].revents & POLLIN)
+			receive();
+	}
+}
+
+} // namespace programmer
@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Copyright(c) 2023 Koko Software. All rights reserved.
+//
+// Author: Adrian Warecki <embedded@kokosoftware.pl>
+
+#include <stdio.h>
+#include <random>
+#include <algorithm>
+#include <thread>
+
+#include <Programmer/types.hpp>
+#include <Programmer/Stream.hpp>
+#include <Programmer/protocol.hpp>
+
+namespace programmer {
+
+StreamProgrammer::StreamProgrammer(const Image& image, uint32_t interface_address)
+	: _session(0), _seq(0), _parity(false), _parity_group(DEFAULT_PARITY_GROUP)
+{
+	for (const Section& sec : image.sections()) {
+		auto data = sec.data();
+
+		for (size_t address = sec.address(); address < sec.end_address(); address++) {
+			const size_t page_addr = address & ~size_t(DeviceDescriptor::ERASE_SIZE - 1);
+			auto [page, inserted] = _pages.try_emplace(page_addr);
+			if (inserted)
+				page->second.fill(std::byte(0xFF));
+
+			page->second[address - page_addr] = data[address - sec.address()];
+		}
+	}
+
+	_socket.set_broadcast(true);
+	_socket.set_multicast_ttl(1);
+	if (interface_address != INADDR_ANY)
+		_socket.set_multicast_interface(interface_address);
+}
+
+// Add a connected target. Targets without CAP_STREAM are programmed over unicast only.
+void StreamProgrammer::add_target(NetworkProgrammer* target) {
+	_targets.push_back(target);
+}
+
+// Send all pages to the group, followed by parity frames if parity_group isn't 0
+void StreamProgrammer::stream(const sockaddr_in& group, size_t parity_group) {
+	constexpr size_t SECTOR_SIZE = sizeof(Protocol::StreamWrite::data);
+	std::array<std::byte, sizeof(Protocol::RequestHeader) + sizeof(Protocol::StreamWrite)> frame;
+	std::array<std::byte, sizeof(Protocol::RequestHeader) + sizeof(Protocol::StreamParity)> parity_frame{};
+	auto header = reinterpret_cast<Protocol::RequestHeader*>(frame.data());
+	auto request = reinterpret_cast<Protocol::StreamWrite*>(frame.data() + sizeof(Protocol::RequestHeader));
+	auto parity_header = reinterpret_cast<Protocol::RequestHeader*>(parity_frame.data());
+	auto parity = reinterpret_cast<Protocol::StreamParity*>(parity_frame.data() + sizeof(Protocol::RequestHeader));
+	auto deadline = std::chrono::steady_clock::now();
+	uint32_t parity_address = 0;
+	uint16_t parity_count = 0;
+
+	header->version = Protocol::VERSION;
+	header->operation = Protocol::OP_STREAM_WRITE;
+	header->status = Protocol::STATUS_REQUEST;
+	header->length = 0;
+	request->session = _session;
+
+	parity_header->version = Protocol::VERSION;
+	parity_header->operation = Protocol::OP_STREAM_PARITY;
+	parity_header->status = Protocol::STATUS_REQUEST;
+	parity->session = _session;
+
+	// Parity covers writes with the preceding sequence numbers
+	auto send_parity = [&]() {
+		parity_header->seq = _seq++;
+		parity_header->address = parity_address;
+		parity_header->length = parity_count;
+
+		std::this_thread::sleep_until(deadline);
+		_socket.sendto(parity_frame, 0, &group, sizeof(group));
+		deadline += WRITE_INTERVAL;
+
+		parity_address = 0;
+		parity_count = 0;
+		memset(parity->data, 0, sizeof(parity->data));
+	};
+
+	for (const auto& [address, page] : _pages) {
+		for (size_t offset = 0; offset < page.size(); offset += SECTOR_SIZE) {
+			header->seq = _seq++;
+			header->address = static_cast<uint32_t>(address + offset);
+			memcpy(request->data, page.data() + offset, SECTOR_SIZE);
+
+			// Targets can't slow the stream down, so keep below their write rate
+			std::this_thread::sleep_until(deadline);
+			_socket.sendto(frame, 0, &group, sizeof(group));
+			deadline += offset ? WRITE_INTERVAL : ERASE_INTERVAL + WRITE_INTERVAL;
+
+			if (!parity_group)
+				continue;
+
+			parity_address ^= static_cast<uint32_t>(address + offset);
+			for (size_t i = 0; i < SECTOR_SIZE; i++)
+				parity->data[i] ^= request->data[i];
+
+			if (++parity_count == parity_group)
+				send_parity();
+		}
+	}
+
+	if (parity_count)
+		send_parity();
+}
+
+// Choose the parity group size for the next stream from the fraction of pages lost
+void StreamProgrammer::adapt_parity(size_t lost, size_t sent) {
+	if (!sent)
+		return;
+
+	// Parity repairs a single loss in a group. Smaller groups survive more losses,
+	// larger ones cost less bandwidth when the link is clean.
+	if (lost * 100 > sent)
+		_parity_group = MIN_PARITY_GROUP;
+	else if (lost)
+		_parity_group = std::max(_parity_group / 2, MIN_PARITY_GROUP);
+	else
+		_parity_group = std::min(_parity_group + 2, Protocol::MAX_PARITY_GROUP);
+}
+
+// Write pages which the target didn't receive. Returns number of repaired pages.
+size_t StreamProgrammer::repair(NetworkProgrammer& target) {
+	constexpr size_t SECTOR_SIZE = DeviceDescriptor::WRITE_SIZE;
+	const size_t first = _pages.begin()->first;
+	const size_t pages = (_pages.rbegin()->first - first) / DeviceDescriptor::ERASE_SIZE + 1;
+	std::vector<bool> received(pages, false);
+	size_t repaired = 0;
+
+	if (target.get_session_profile().supports(Protocol::CAP_STREAM))
+		received = target.stream_status(static_cast<uint32_t>(first), pages, _session);
+
+	for (const auto& [address, page] : _pages) {
+		if (received[(address - first) / DeviceDescriptor::ERASE_SIZE])
+			continue;
+
+		target.queue_erase(static_cast<uint32_t>(address));
+		for (size_t offset = 0; offset < page.size(); offset += SECTOR_SIZE)
+			target.queue_write(static_cast<uint32_t>(address + offset), std::span(page).subspan(offset, SECTOR_SIZE));
+		repaired++;
+	}
+
+	target.flush();
+	return repaired;
+}
+
+// Send the image to the group and repair pages missed by each target
+void StreamProgrammer::program(uint32_t group_address, uint16_t port) {
+	sockaddr_in group = {};
+	size_t failed = 0;
+	size_t lost = 0;
+	size_t sent = 0;
+
+	if (_pages.empty() || _targets.empty())
+		return;
+
+	group.sin_family = AF_INET;
+	group.sin_port = Network::htons()(port);
+	group.sin_addr.s_addr = group_address;
+
+	// A new session makes targets forget sectors received from the previous one
+	do {
+		_session = static_cast<uint16_t>(std::random_device()());
+	} while (!_session);
+
+	bool parity = _parity;
+	for (const auto target : _targets)
+		parity &= target->get_session_profile().supports(Protocol::CAP_STREAM_PARITY);
+
+	stream(group, parity ? _parity_group : 0);
+	printf("Streamed %zu pages to %zu targets, session %u, parity group %zu\n", _pages.size(), _targets.size(),
+		   _session, parity ? _parity_group : 0);
+
+	for (size_t i = 0; i < _targets.size(); i++) {
+		try {
+			const size_t repaired = repair(*_targets[i]);
+			printf("Target %zu: %zu pages repaired\n", i, repaired);
+
+			if (_targets[i]->get_session_profile().supports(Protocol::CAP_STREAM)) {
+				lost += repaired;
+				sent += _pages.size();
+			}
+		}
+		catch (Exception& err) {
+			err.prepend("Target {}:", i);
+			printf("%s\n", err.what());
+			failed++;
+		}
+	}
+
+	if (parity)
+		adapt_parity(lost, sent);
+
+	if (failed)
+		throw Exception("Programming of {} out of {} targets failed.", failed, _targets.size());
+}
+
+} // namespace programmer
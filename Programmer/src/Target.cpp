@@ -5,18 +5,70 @@
 // Author: Adrian Warecki <embedded@kokosoftware.pl>
 
 #include <stdio.h>
+#include <cstddef>
+#include <array>
+#include <algorithm>
+#include <chrono>
+#include <format>
 #include <ws2tcpip.h>
 //#include <arpa/inet.h>
 
 #include <Programmer/Target.hpp>
 #include <Programmer/protocol.hpp>
+#include <Programmer/Compression.hpp>
+#include <Programmer/DeviceDescriptor.hpp>
 
 namespace programmer {
 
-Target::Target(uint16_t dev_id, size_t flash_size)
-	: _dev_id(dev_id)
+Target::Target(uint16_t dev_id, size_t flash_size, uint16_t port, uint32_t address)
+	: _dev_id(dev_id), _bootloader_address(0), _port(port), _address(address), _verbose(true), _capabilities(0), _mac{}, _has_mac(false), _configured(true), _programmer_addr{}, _last_seq(0), _stats{},
+	_timing{}, _flash(std::make_unique<FlashMemory>(flash_size)), _stream_session(0)
 {
-	_flash.resize(flash_size * 1024);
+	_bootloader_address = static_cast<uint32_t>(_flash->size() - ERASE_SIZE - BOOTLOADER_SIZE) & ~(BOOTLOADER_SIZE - 1);
+	_stream_sectors.resize(_flash->size() / ERASE_SIZE);
+	_erase_counts.resize(_flash->size() / ERASE_SIZE);
+	_stream_frames.fill({});
+}
+
+// Keep the flash in a sparse file, content of an existing file is loaded
+void Target::map_flash(const std::filesystem::path& path) {
+	_flash = std::make_unique<FlashMemory>(_flash->size(), path);
+}
+
+// Set the flash to the snapshot, pages are shared until written. The board starts a new run.
+void Target::restore_flash(std::shared_ptr<const FlashSnapshot> snapshot) {
+	if (snapshot->size() != _flash->size())
+		throw Exception("Snapshot of {} bytes doesn't match flash of {} bytes.", snapshot->size(), _flash->size());
+
+	_flash = std::make_unique<FlashMemory>(std::move(snapshot));
+	std::fill(_stream_sectors.begin(), _stream_sectors.end(), 0);
+	_stream_frames.fill({});
+	_stream_session = 0;
+	clear_statistics();
+}
+
+// Receive stream writes sent to a multicast or broadcast group
+void Target::join_group(uint32_t group_address, uint16_t port) {
+	sockaddr_in addr = {};
+
+	_group_socket = std::make_unique<SocketUDP>();
+	_group_socket->set_reuse_address(true);
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = Network::htons()(port);
+	addr.sin_addr.s_addr = INADDR_ANY;
+	_group_socket->bind(&addr);
+
+	if (IN_MULTICAST(Network::ntohl()(group_address)))
+		_group_socket->join_group(group_address);
+}
+
+// Simulate a factory-fresh board
+void Target::set_unconfigured(const MacAddress& mac) {
+	_mac = mac;
+	_has_mac = true;
+	_configured = false;
+	_assigned_socket.reset();
 }
 
 const char* Target::get_operation_name(uint8_t op) {
@@ -30,6 +82,13 @@ const char* Target::get_operation_name(uint8_t op) {
 		case Protocol::OP_WRITE: return "OP_WRITE";
 		case Protocol::OP_ERASE_WRITE: return "OP_ERASE_WRITE";
 		case Protocol::OP_CHIP_ERASE: return "OP_CHIP_ERASE";
+		case Protocol::OP_CHECKSUM_PAGES: return "OP_CHECKSUM_PAGES";
+		case Protocol::OP_BLANK_CHECK: return "OP_BLANK_CHECK";
+		case Protocol::OP_COMPOUND: return "OP_COMPOUND";
+		case Protocol::OP_WRITE_PACKED: return "OP_WRITE_PACKED";
+		case Protocol::OP_STREAM_WRITE: return "OP_STREAM_WRITE";
+		case Protocol::OP_STREAM_STATUS: return "OP_STREAM_STATUS";
+		case Protocol::OP_STREAM_PARITY: return "OP_STREAM_PARITY";
 		default: return "Invalid";
 	}
 }
@@ -43,13 +102,18 @@ const char* Target::get_status_name(uint8_t stat) {
 		case Protocol::STATUS_INV_OP: return "STATUS_INV_OP";
 		case Protocol::STATUS_INV_PARAM: return "STATUS_INV_PARAM";
 		case Protocol::STATUS_INV_SRC: return "STATUS_INV_SRC";
+		case Protocol::STATUS_INV_LENGTH: return "STATUS_INV_LENGTH";
 		case Protocol::STATUS_INV_ADDR: return "STATUS_INV_ADDR";
+		case Protocol::STATUS_PROTECTED_ADDR: return "STATUS_PROTECTED_ADDR";
 		case Protocol::STATUS_PKT_SIZE: return "STATUS_PKT_SIZE";
 		default: return "Invalid";
 	}
 }
 
 void Target::hexdump(const void* buf, size_t len) {
+	if (!_verbose)
+		return;
+
 	const unsigned char* b = reinterpret_cast<const unsigned char*>(buf);
 	const unsigned char* end = b + len;
 	while (b < end)
@@ -63,158 +127,964 @@ constexpr bool operator ==(const sockaddr_in& a, const sockaddr_in& b) noexcept
 }
 
 void Target::send(const void* buf, size_t size, const sockaddr_in* addr) {
-	printf("\n");
+	log("\n");
 	size += sizeof(Protocol::ReplyHeader);
 	hexdump(buf, size);
 
 	const auto hdr = reinterpret_cast<const Protocol::ReplyHeader*>(buf);
-	printf("Tx %zu bytes: ver: %u, seq: %u, op: %u (%s), stat: %u (%s)", size,
+	log("Tx %zu bytes: ver: %u, seq: %u, op: %u (%s), stat: %u (%s)", size,
 		hdr->version, hdr->seq, hdr->operation, get_operation_name(hdr->operation), hdr->status, get_status_name(hdr->status));
 
-	_socket.sendto(std::span<const std::byte>(reinterpret_cast<const std::byte*>(buf), size), 0, addr, sizeof(*addr));
+	const auto data = std::span<const std::byte>(reinterpret_cast<const std::byte*>(buf), size);
+	if (_reply_time > std::chrono::steady_clock::now()) {
+		_replies.push_back({ _reply_time, *addr, std::vector<std::byte>(data.begin(), data.end()) });
+		return;
+	}
+
+	transmit(data, addr);
+}
+
+// Send a reply now, a full socket buffer loses it like the network would
+void Target::transmit(std::span<const std::byte> data, const sockaddr_in* addr) {
+	SocketUDP& socket = _assigned_socket ? *_assigned_socket : _socket;
+
+	try {
+		socket.sendto(data, 0, addr, sizeof(*addr));
+		_stats.tx_frames++;
+	}
+	catch (const SocketException& e) {
+		// Boards of a fleet use nonblocking sockets
+		if (e.code().value() != WSAEWOULDBLOCK)
+			throw;
+
+		_stats.tx_dropped++;
+	}
+}
+
+// A factory-fresh board answers from the address assigned by OP_NET_CONFIG
+void Target::assign_address(uint32_t address) {
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = address;
+
+	try {
+		auto socket = std::make_unique<SocketUDP>();
+		socket->bind(&addr);
+		socket->report_unreachable(false);
+		_assigned_socket = std::move(socket);
+	}
+	catch (const SocketException& e) {
+		// The address isn't local, keep answering from the board's socket
+		log("Unable to take the assigned address: %s\n", e.what());
+	}
+}
+
+// Model operation durations. Jitter is reproducible for the seed.
+void Target::set_timing(const Timing& timing, uint32_t seed) {
+	_timing = timing;
+	_jitter_rng.seed(seed);
+}
+
+// Final reply of the current request is sent after the modelled duration of its operation
+void Target::delay(uint32_t duration_us) {
+	using std::chrono::steady_clock;
+
+	if (!duration_us)
+		return;
+
+	double duration = duration_us;
+	if (_timing.jitter > 0) {
+		std::uniform_real_distribution<double> jitter(-_timing.jitter, _timing.jitter);
+		duration *= 1 + jitter(_jitter_rng);
+	}
+
+	// Queued requests start after the running operation
+	const auto start = std::max(steady_clock::now(), _busy_until);
+	_busy_until = start + std::chrono::duration_cast<steady_clock::duration>(std::chrono::duration<double, std::micro>(duration));
+	_reply_time = _busy_until;
+}
+
+// Send replies of finished operations
+std::chrono::steady_clock::time_point Target::send_replies() {
+	const auto now = std::chrono::steady_clock::now();
+
+	while (!_replies.empty() && (_replies.front().time <= now)) {
+		const DelayedReply& reply = _replies.front();
+		transmit(reply.data, &reply.address);
+		_replies.pop_front();
+	}
+
+	return _replies.empty() ? std::chrono::steady_clock::time_point::max() : _replies.front().time;
+}
+
+void Target::clear_statistics() {
+	_stats = {};
+	std::fill(_erase_counts.begin(), _erase_counts.end(), 0);
+}
+
+// The bootloader can't be erased or overwritten
+bool Target::is_protected(uint32_t address, uint32_t length) const {
+	return (address < _bootloader_address + BOOTLOADER_SIZE) && (address + length > _bootloader_address);
+}
+
+Protocol::Status Target::check_erase(uint32_t address) const {
+	if ((address % ERASE_SIZE) || (address >= _flash->size()))
+		return Protocol::STATUS_INV_ADDR;
+
+	if (is_protected(address, ERASE_SIZE))
+		return Protocol::STATUS_PROTECTED_ADDR;
+
+	return Protocol::STATUS_OK;
+}
+
+void Target::erase(uint32_t address) {
+	_flash->erase(address, ERASE_SIZE);
+	_erase_counts[address / ERASE_SIZE]++;
+	_stats.erases++;
+}
+
+// Same order of checks as the bootloader: the address, the length and then the protection
+Protocol::Status Target::check_write(uint32_t address, uint32_t length) const {
+	if ((address % WRITE_SIZE) || (address >= _flash->size()))
+		return Protocol::STATUS_INV_ADDR;
+
+	if (!length || (length % WRITE_SIZE) || (address + length > _flash->size()))
+		return Protocol::STATUS_INV_LENGTH;
+
+	if (is_protected(address, length))
+		return Protocol::STATUS_PROTECTED_ADDR;
+
+	return Protocol::STATUS_OK;
+}
+
+// A plain write carries a single sector
+Protocol::Status Target::check_sector(uint32_t address, uint32_t length) const {
+	const auto status = check_write(address, length);
+	if ((status == Protocol::STATUS_OK) && (length > WRITE_SIZE))
+		return Protocol::STATUS_INV_LENGTH;
+
+	return status;
+}
+
+void Target::write(uint32_t address, const void* data) {
+	_flash->write(address, std::span(static_cast<const std::byte*>(data), WRITE_SIZE));
+	_stats.writes++;
+}
+
+// Start over after OP_RESET, the programmer has to discover the board again
+void Target::reboot() {
+	_programmer_addr = {};
+	_capabilities = 0;
+	_busy_until = {};
+	std::fill(_stream_sectors.begin(), _stream_sectors.end(), 0);
+	_stream_frames.fill({});
+}
+
+// Decode packed write data and validate its destination
+Protocol::Status Target::unpack(uint32_t address, std::span<const std::byte> packed,
+								std::span<std::byte, ERASE_SIZE> data, size_t& size) const {
+	size = PackBits::decode(packed, data);
+	if ((size == SIZE_MAX) || !size || (size % WRITE_SIZE))
+		return Protocol::STATUS_INV_LENGTH;
+
+	// Data can't cross an erase page
+	if ((address % ERASE_SIZE) + size > ERASE_SIZE)
+		return Protocol::STATUS_INV_LENGTH;
+
+	return check_write(address, static_cast<uint32_t>(size));
+}
+
+// Write a sector received from the stream, erasing its page first if needed
+void Target::stream_write(uint32_t address, uint16_t session, const void* data) {
+	if (check_write(address) != Protocol::STATUS_OK) {
+		log("Invalid stream address!");
+		return;
+	}
+
+	if (session != _stream_session) {
+		std::fill(_stream_sectors.begin(), _stream_sectors.end(), 0);
+		_stream_session = session;
+	}
+
+	uint16_t& sectors = _stream_sectors[address / ERASE_SIZE];
+	const uint16_t bit = 1 << ((address % ERASE_SIZE) / WRITE_SIZE);
+	if (sectors & bit) {
+		log("Duplicated stream sector!");
+		return;
+	}
+
+	if (!sectors)
+		erase(address - address % ERASE_SIZE);
+	write(address, data);
+	sectors |= bit;
+}
+
+// Rebuild a single lost stream write of a group from its parity
+void Target::stream_parity(uint8_t seq, uint16_t count, uint32_t address, uint16_t session, const std::byte* data) {
+	std::array<std::byte, WRITE_SIZE> rebuilt;
+	size_t missing = 0;
+
+	if (!count || (count > Protocol::MAX_PARITY_GROUP) || (session != _stream_session)) {
+		log("Invalid parity group!");
+		return;
+	}
+
+	std::copy_n(data, WRITE_SIZE, rebuilt.begin());
+	for (uint16_t i = 0; i < count; i++) {
+		const uint8_t frame_seq = static_cast<uint8_t>(seq - count + i);
+		const StreamFrame& frame = _stream_frames[frame_seq % _stream_frames.size()];
+		if (!frame.valid || (frame.seq != frame_seq) || (frame.session != session)) {
+			missing++;
+			continue;
+		}
+
+		address ^= frame.address;
+		for (size_t j = 0; j < WRITE_SIZE; j++)
+			rebuilt[j] ^= frame.data[j];
+	}
+
+	if (missing != 1) {
+		log("%zu writes missing in the parity group", missing);
+		return;
+	}
+
+	log("Rebuilt write at 0x%06X ", address);
+	stream_write(address, session, rebuilt.data());
+}
+
+// Send STATUS_INPROGRESS unless the host negotiated to skip it for fast operations
+void Target::acknowledge(void* buf, uint32_t duration_us, const sockaddr_in* addr) {
+	if ((_capabilities & Protocol::CAP_QUIET_ACK) && (duration_us < Protocol::QUIET_ACK_THRESHOLD_US))
+		return;
+
+	reinterpret_cast<Protocol::ReplyHeader*>(buf)->status = Protocol::STATUS_INPROGRESS;
+	send(buf, 0, addr);
+}
+
+// Bind the board's socket, requests are then handled by service()
+void Target::open(bool nonblocking) {
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = Network::htons()(_port);
+	addr.sin_addr.s_addr = _address;
+	_socket.bind(&addr);
+
+	// A programmer which exited before its reply arrived must not fail the next recvfrom
+	_socket.report_unreachable(false);
+	if (_group_socket)
+		_group_socket->report_unreachable(false);
+
+	if (nonblocking) {
+		_socket.set_nonblocking(true);
+		if (_group_socket)
+			_group_socket->set_nonblocking(true);
+	}
+}
+
+// Handle all requests waiting in the socket. Returns number of received frames.
+size_t Target::service(SocketUDP& socket) {
+	size_t count = 0;
+
+	for (;;) {
+		sockaddr_in rx_addr;
+		int rx_addr_size = sizeof(rx_addr);
+		const int len = socket.recvfrom(_frame.raw, 0, &rx_addr, &rx_addr_size);
+		if (len < 0)
+			return count;
+
+		count++;
+		_stats.rx_frames++;
+		process(_frame, len, rx_addr);
+	}
 }
 
 void Target::start() {
-	sockaddr_in rx_addr;
-	sockaddr_in programmer_addr;
-	int rx_addr_size;
-	char addr[INET_ADDRSTRLEN] = {0xCD};
-	uint8_t last_seq = 0;
-
-	union {
-		std::byte raw[1500];
-		union {
-			struct {
-				Protocol::RequestHeader header;
-				Protocol::Write write;
-			} request;
-			struct {
-				Protocol::ReplyHeader header;
-				union {
-					Protocol::DiscoverReply dr;
-					unsigned char payload[1500 - sizeof(Protocol::ReplyHeader)];
-				};
-			} reply;
-		};
-	} buf;
-
-	rx_addr.sin_family = AF_INET;
-	rx_addr.sin_port = Network::htons()(Protocol::PORT);
-	rx_addr.sin_addr.s_addr = INADDR_ANY;
-	_socket.bind(&rx_addr);
+	open(true);
+
+	std::array<pollfd, 2> fds = {{ { _socket, POLLRDNORM, 0 }, { INVALID_SOCKET, POLLRDNORM, 0 } }};
+	if (_group_socket)
+		fds[1].fd = *_group_socket;
 
 	while (1) {
-		rx_addr_size = sizeof(rx_addr);
-		int len = _socket.recvfrom(buf.raw, 0, &rx_addr, &rx_addr_size);
-		hexdump(buf.raw, len);
-		inet_ntop(rx_addr.sin_family, &rx_addr.sin_addr, addr, sizeof(addr));
-		printf("Rx: %s:%d %d bytes ", addr, Network::ntohs()(rx_addr.sin_port), len);
-		if (len < sizeof(buf.request.header)) {
-			printf("Packet too short!\n");
-			continue;
+		// Wake up when a delayed reply is due
+		Network::poll(std::span(fds.data(), _group_socket ? 2 : 1), send_replies());
+
+		if (fds[0].revents & POLLRDNORM)
+			service(_socket);
+		if (_group_socket && (fds[1].revents & POLLRDNORM))
+			service(*_group_socket);
+	}
+}
+
+// Handle a received request
+void Target::process(Frame& frame, int len, const sockaddr_in& rx_addr) {
+	_reply_time = {};
+	hexdump(frame.raw, len);
+	char addr[INET_ADDRSTRLEN] = {};
+	inet_ntop(rx_addr.sin_family, &rx_addr.sin_addr, addr, sizeof(addr));
+	log("Rx: %s:%d %d bytes ", addr, Network::ntohs()(rx_addr.sin_port), len);
+	if (len < sizeof(frame.request.header)) {
+		log("Packet too short!\n");
+		return;
+	}
+
+	log("ver: %u, seq: %u, op: %u (%s), stat: %u (%s) ",
+		   frame.request.header.version, frame.request.header.seq, frame.request.header.operation,
+		   get_operation_name(frame.request.header.operation), frame.request.header.status,
+		get_status_name(frame.request.header.status));
+	if (frame.request.header.version != Protocol::VERSION) {
+		log("Invalid version!\n");
+		return;
+	}
+
+	if (frame.request.header.status != Protocol::STATUS_REQUEST) {
+		log("Invalid status!\n");
+		return;
+	}
+
+	// Stream writes aren't acknowledged, only the programmer's address is checked
+	if (frame.request.header.operation == Protocol::OP_STREAM_WRITE) {
+		if (!(_capabilities & Protocol::CAP_STREAM) || (rx_addr.sin_addr.s_addr != _programmer_addr.sin_addr.s_addr))
+			log("Invalid stream sender!\n");
+		else if (len < sizeof(frame.request.header) + sizeof(frame.request.stream_write))
+			log("Stream packet too short!\n");
+		else {
+			StreamFrame& stream = _stream_frames[frame.request.header.seq % _stream_frames.size()];
+			stream.valid = true;
+			stream.seq = frame.request.header.seq;
+			stream.session = frame.request.stream_write.session;
+			stream.address = frame.request.header.address;
+			memcpy(stream.data.data(), frame.request.stream_write.data, WRITE_SIZE);
+
+			stream_write(stream.address, stream.session, stream.data.data());
+			log("\n");
 		}
+		return;
+	}
 
-		printf("ver: %u, seq: %u, op: %u (%s), stat: %u (%s) ",
-			   buf.request.header.version, buf.request.header.seq, buf.request.header.operation,
-			   get_operation_name(buf.request.header.operation), buf.request.header.status,
-			get_status_name(buf.request.header.status));
-		if (buf.request.header.version != Protocol::VERSION) {
-			printf("Invalid version!\n");
-			continue;
+	if (frame.request.header.operation == Protocol::OP_STREAM_PARITY) {
+		if (!(_capabilities & Protocol::CAP_STREAM_PARITY) || (rx_addr.sin_addr.s_addr != _programmer_addr.sin_addr.s_addr))
+			log("Invalid stream sender!\n");
+		else if (len < sizeof(frame.request.header) + sizeof(frame.request.stream_parity))
+			log("Stream packet too short!\n");
+		else {
+			stream_parity(frame.request.header.seq, frame.request.header.length, frame.request.header.address,
+						  frame.request.stream_parity.session,
+						  reinterpret_cast<const std::byte*>(frame.request.stream_parity.data));
+			log("\n");
 		}
+		return;
+	}
 
-		if (buf.request.header.status != Protocol::STATUS_REQUEST) {
-			printf("Invalid status!\n");
-			continue;
+	// A board with a MAC accepts only the network configuration addressed to it
+	if (_has_mac && (frame.request.header.operation == Protocol::OP_NET_CONFIG)) {
+		if ((len < sizeof(frame.request.header) + sizeof(frame.request.net_config.mac_address)) ||
+			memcmp(frame.request.net_config.mac_address, _mac.data(), _mac.size())) {
+			log("Configuration of another board\n");
+			return;
+		}
+		_configured = true;
+	}
+
+	if (!_configured) {
+		log("Not configured!\n");
+		return;
+	}
+
+	if ((frame.request.header.operation != Protocol::OP_DISCOVER) &&
+		(frame.request.header.operation != Protocol::OP_NET_CONFIG)) {
+		if (frame.request.header.seq == _last_seq) {
+			log("Duplicated seq!\n");
+			return;
+		}
+
+		if (rx_addr != _programmer_addr) {
+			log("Invalid sender!\n");
+			frame.request.header.status = Protocol::STATUS_INV_SRC;
+			send(&frame, 0, &rx_addr);
+			return;
+		}
+
+		// The request is lost like on a device without a free receive buffer, its retransmission is accepted later
+		if (_timing.reject_busy && (std::chrono::steady_clock::now() < _busy_until)) {
+			log("Busy!\n");
+			return;
 		}
+	}
+	_last_seq = frame.request.header.seq;
+
+	switch (frame.request.header.operation) {
+		case Protocol::OP_DISCOVER:
+		case Protocol::OP_NET_CONFIG:
+			_programmer_addr = rx_addr;
+
+			// Requests from older hosts carry no capabilities
+			_capabilities = 0;
+			if ((frame.request.header.operation == Protocol::OP_DISCOVER) &&
+				(len >= sizeof(frame.request.header) + sizeof(frame.request.discover)))
+				_capabilities = frame.request.discover.capabilities & CAPABILITIES;
+			if ((frame.request.header.operation == Protocol::OP_NET_CONFIG) &&
+				(len >= sizeof(frame.request.header) + sizeof(frame.request.net_config)))
+				_capabilities = frame.request.net_config.capabilities & CAPABILITIES;
+
+			if (_has_mac && (frame.request.header.operation == Protocol::OP_NET_CONFIG) &&
+				(len >= sizeof(frame.request.header) + offsetof(Protocol::NetworkConfig, capabilities)))
+				assign_address(frame.request.net_config.ip_address);
+
+			frame.reply.header.status = Protocol::STATUS_OK;
+			frame.reply.dr.bootloader_address = _bootloader_address;
+			frame.reply.dr.version = BOOTLOADER_VERSION;
+			frame.reply.dr.device_id = _dev_id;
+			frame.reply.dr.capabilities = _capabilities;
+			frame.reply.dr.max_request = Protocol::MAX_FRAME;
+			frame.reply.dr.max_reply = MAX_REPLY;
+			frame.reply.dr.window = 1;
+			frame.reply.dr.checksum = Protocol::CHECKSUM_FLETCHER32;
+			send(&frame, sizeof(frame.reply.dr), &rx_addr);
+			break;
+
+		case Protocol::OP_ERASE:
+		{
+			const uint32_t addr = frame.request.header.address;
+			log("Erase 0x%06X ", addr);
+
+			auto status = check_erase(addr);
+			if (status != Protocol::STATUS_OK) {
+				frame.reply.header.status = status;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
 
-		if ((buf.request.header.operation != Protocol::OP_DISCOVER) &&
-			(buf.request.header.operation != Protocol::OP_NET_CONFIG)) {
-			if (buf.request.header.seq == last_seq) {
-				printf("Duplicated seq!\n");
-				continue;
+			acknowledge(&frame, ERASE_TIME_US, &rx_addr);
+			delay(_timing.erase_us);
+			erase(addr);
+			frame.reply.header.status = Protocol::STATUS_OK;
+			send(&frame, 0, &rx_addr);
+			break;
+		}
+
+		case Protocol::OP_WRITE:
+		{
+			const uint32_t addr = frame.request.header.address;
+			log("Write to 0x%06X ", addr);
+
+			if (len < sizeof(frame.request.header) + sizeof(frame.request.write)) {
+				frame.reply.header.status = Protocol::STATUS_PKT_SIZE;
+				send(&frame, 0, &rx_addr);
+				return;
 			}
 
-			if (rx_addr != programmer_addr) {
-				printf("Invalid sender!\n");
-				buf.request.header.status = Protocol::STATUS_INV_SRC;
-				send(&buf, 0, &rx_addr);
-				continue;
+			auto status = check_sector(addr, frame.request.header.length);
+			if (status != Protocol::STATUS_OK) {
+				frame.reply.header.status = status;
+				send(&frame, 0, &rx_addr);
+				return;
 			}
+
+			acknowledge(&frame, WRITE_TIME_US, &rx_addr);
+			delay(_timing.write_us);
+			write(addr, frame.request.write.data);
+			frame.reply.header.status = Protocol::STATUS_OK;
+			send(&frame, 0, &rx_addr);
+			break;
 		}
-		last_seq = buf.request.header.seq;
 
-		switch (buf.request.header.operation) {
-			case Protocol::OP_DISCOVER:
-			case Protocol::OP_NET_CONFIG:
-				programmer_addr = rx_addr;
-				buf.reply.header.status = Protocol::STATUS_OK;
-				buf.reply.dr.bootloader_address = 0xDEADBEEF;
-				buf.reply.dr.version = 0x0100;
-				buf.reply.dr.device_id = _dev_id;
-				send(&buf, sizeof(buf.reply.dr), &rx_addr);
-				break;
+		case Protocol::OP_WRITE_PACKED:
+		{
+			const uint32_t addr = frame.request.header.address;
+			const uint16_t length = frame.request.header.length;
+			log("Packed write of %u bytes to 0x%06X ", length, addr);
 
-			case Protocol::OP_ERASE:
-				printf("Erase 0x%06X ", buf.request.header.address.native());
+			if (sizeof(frame.request.header) + length != len) {
+				frame.reply.header.status = Protocol::STATUS_PKT_SIZE;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
 
-				if ((buf.request.header.address % ERASE_SIZE) || (buf.request.header.address >= _flash.size())) {
-					buf.request.header.status = Protocol::STATUS_INV_PARAM;
-					send(&buf, 0, &rx_addr);
-					continue;
-				}
+			std::array<std::byte, ERASE_SIZE> data;
+			const auto packed = std::span(frame.raw + sizeof(frame.request.header), length);
+			size_t size = 0;
+			auto status = unpack(addr, packed, data, size);
+			if (status != Protocol::STATUS_OK) {
+				frame.reply.header.status = status;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			acknowledge(&frame, WRITE_TIME_US * static_cast<uint32_t>(size / WRITE_SIZE), &rx_addr);
+			delay(_timing.write_us * static_cast<uint32_t>(size / WRITE_SIZE));
+			for (size_t i = 0; i < size; i += WRITE_SIZE)
+				write(addr + static_cast<uint32_t>(i), data.data() + i);
+			frame.reply.header.status = Protocol::STATUS_OK;
+			send(&frame, 0, &rx_addr);
+			break;
+		}
 
-				buf.reply.header.status = Protocol::STATUS_INPROGRESS;
-				send(&buf, 0, &rx_addr);
-				memset(_flash.data() + buf.request.header.address, 0xff, ERASE_SIZE);
-				buf.reply.header.status = Protocol::STATUS_OK;
-				send(&buf, 0, &rx_addr);
-				break;
+		case Protocol::OP_COMPOUND:
+		{
+			const uint16_t count = frame.request.header.length;
+			log("Compound of %u operations ", count);
 
-			case Protocol::OP_WRITE:
-				printf("Write to 0x%06X ", buf.request.header.address.native());
+			// Validate the frame layout before executing anything
+			std::vector<const Protocol::RequestHeader*> items;
+			size_t pos = sizeof(frame.request.header);
+			uint32_t duration = 0;
+			uint32_t modelled = 0;
+			while ((items.size() < count) && (pos + sizeof(Protocol::RequestHeader) <= len)) {
+				auto item = reinterpret_cast<const Protocol::RequestHeader*>(frame.raw + pos);
+				const int payload = Protocol::compound_payload_size(*item);
+				if (payload < 0)
+					break;
 
-				if ((buf.request.header.address % WRITE_SIZE) || (buf.request.header.address >= _flash.size())) {
-					buf.reply.header.status = Protocol::STATUS_INV_PARAM;
-					send(&buf, 0, &rx_addr);
-					continue;
-				}
+				pos += sizeof(Protocol::RequestHeader) + payload;
+				// Packed writes are estimated as a single sector
+				duration += (item->operation == Protocol::OP_ERASE) ? ERASE_TIME_US : WRITE_TIME_US;
+				modelled += (item->operation == Protocol::OP_ERASE) ? _timing.erase_us : _timing.write_us;
+				items.push_back(item);
+			}
+
+			if (!count || (items.size() != count) || (pos != len) || (count > MAX_REPLY - sizeof(frame.reply.header))) {
+				frame.reply.header.status = (pos > len) ? Protocol::STATUS_PKT_SIZE : Protocol::STATUS_INV_PARAM;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			acknowledge(&frame, duration, &rx_addr);
+			delay(modelled);
 
-				buf.reply.header.status = Protocol::STATUS_INPROGRESS;
-				send(&buf, 0, &rx_addr);
-				memcpy(_flash.data() + buf.request.header.address, buf.request.write.data, WRITE_SIZE);
-				buf.reply.header.status = Protocol::STATUS_OK;
-				send(&buf, 0, &rx_addr);
-				break;
-
-			case Protocol::OP_READ:
-			{
-				uint32_t addr = buf.request.header.address;
-				uint32_t length = buf.request.header.length;
-				printf("Read %u from 0x%06X ", length, addr);
-				if (((addr + length) > _flash.size()) ||
-					(length > sizeof(buf.reply.payload))) {
-					buf.reply.header.status = Protocol::STATUS_INV_PARAM;
-					send(&buf, 0, &rx_addr);
-					continue;
+			// Execute until the first failure, remaining operations are reported as not processed
+			std::vector<uint8_t> statuses(count, Protocol::STATUS_REQUEST);
+			for (size_t i = 0; i < count; i++) {
+				const auto item = items[i];
+				const uint32_t item_addr = item->address;
+				Protocol::Status status;
+
+				if (item->operation == Protocol::OP_ERASE) {
+					status = check_erase(item_addr);
+					if (status == Protocol::STATUS_OK)
+						erase(item_addr);
+				} else if (item->operation == Protocol::OP_WRITE_PACKED) {
+					std::array<std::byte, ERASE_SIZE> data;
+					const auto packed = std::span(reinterpret_cast<const std::byte*>(item + 1), item->length.native());
+					size_t size = 0;
+					status = unpack(item_addr, packed, data, size);
+					for (size_t i = 0; (status == Protocol::STATUS_OK) && (i < size); i += WRITE_SIZE)
+						write(item_addr + static_cast<uint32_t>(i), data.data() + i);
+				} else {
+					status = check_sector(item_addr, item->length);
+					if (status == Protocol::STATUS_OK)
+						write(item_addr, reinterpret_cast<const Protocol::Write*>(item + 1)->data);
 				}
 
-				buf.reply.header.status = Protocol::STATUS_INPROGRESS;
-				send(&buf, 0, &rx_addr);
-				memcpy(buf.reply.payload, _flash.data() + addr, length);
-				buf.reply.header.status = Protocol::STATUS_OK;
-				send(&buf, length, &rx_addr);
-				break;
+				statuses[i] = status;
+				if (status != Protocol::STATUS_OK)
+					break;
+			}
+
+			memcpy(frame.reply.payload, statuses.data(), count);
+			frame.reply.header.status = Protocol::STATUS_OK;
+			send(&frame, count, &rx_addr);
+			break;
+		}
+
+		case Protocol::OP_READ:
+		{
+			uint32_t addr = frame.request.header.address;
+			uint32_t length = frame.request.header.length;
+			log("Read %u from 0x%06X ", length, addr);
+			if (addr >= _flash->size()) {
+				frame.reply.header.status = Protocol::STATUS_INV_ADDR;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			// Flash is read by words
+			if (!length || (length % 2) || (length > MAX_REPLY - sizeof(frame.reply.header)) ||
+				(addr + length > _flash->size())) {
+				frame.reply.header.status = Protocol::STATUS_INV_LENGTH;
+				send(&frame, 0, &rx_addr);
+				return;
 			}
 
-			default:
-				printf("Unsupported operation!");
-				buf.reply.header.status = Protocol::STATUS_INV_OP;
-				send(&buf, 0, &rx_addr);
+			acknowledge(&frame, READ_TIME_US, &rx_addr);
+			delay(_timing.read_us);
+			_flash->read(addr, std::span(reinterpret_cast<std::byte*>(frame.reply.payload), length));
+			frame.reply.header.status = Protocol::STATUS_OK;
+			send(&frame, length, &rx_addr);
+			break;
 		}
 
-		printf("\n");
+		case Protocol::OP_ERASE_WRITE:
+		{
+			const uint32_t addr = frame.request.header.address;
+			log("Erase and write 0x%06X ", addr);
+
+			if (len < sizeof(frame.request.header) + sizeof(frame.request.erase_write)) {
+				frame.reply.header.status = Protocol::STATUS_PKT_SIZE;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			auto status = check_erase(addr);
+			if (status != Protocol::STATUS_OK) {
+				frame.reply.header.status = status;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			acknowledge(&frame, ERASE_TIME_US + WRITE_TIME_US, &rx_addr);
+			delay(_timing.erase_us + _timing.write_us);
+			erase(addr);
+			write(addr, frame.request.erase_write.data);
+			frame.reply.header.status = Protocol::STATUS_OK;
+			send(&frame, 0, &rx_addr);
+			break;
+		}
+
+		case Protocol::OP_CHIP_ERASE:
+		{
+			log("Chip erase ");
+
+			// Everything except the bootloader
+			const uint32_t pages = static_cast<uint32_t>(_flash->size() / ERASE_SIZE - BOOTLOADER_SIZE / ERASE_SIZE);
+			acknowledge(&frame, ERASE_TIME_US * pages, &rx_addr);
+			delay(_timing.erase_us * pages);
+			for (uint32_t addr = 0; addr < _flash->size(); addr += ERASE_SIZE)
+				if (!is_protected(addr, ERASE_SIZE))
+					erase(addr);
+			frame.reply.header.status = Protocol::STATUS_OK;
+			send(&frame, 0, &rx_addr);
+			break;
+		}
+
+		case Protocol::OP_RESET:
+			log("Reset ");
+			frame.reply.header.status = Protocol::STATUS_OK;
+			send(&frame, 0, &rx_addr);
+			reboot();
+			break;
+
+		case Protocol::OP_CHECKSUM:
+		{
+			const uint32_t addr = frame.request.header.address;
+			const uint32_t length = frame.request.header.length;
+			log("Checksum %u bytes from 0x%06X ", length, addr);
+			if (addr >= _flash->size()) {
+				frame.reply.header.status = Protocol::STATUS_INV_ADDR;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			if (!length || (addr + length > _flash->size())) {
+				frame.reply.header.status = Protocol::STATUS_INV_LENGTH;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			const uint32_t pages = (length + ERASE_SIZE - 1) / ERASE_SIZE;
+			acknowledge(&frame, CHECKSUM_PAGE_TIME_US * pages, &rx_addr);
+			delay(_timing.checksum_page_us * pages);
+			std::vector<std::byte> data(length);
+			_flash->read(addr, data);
+			auto reply = reinterpret_cast<Protocol::ChecksumReply*>(frame.reply.payload);
+			reply->checksum = Protocol::checksum(data);
+			frame.reply.header.status = Protocol::STATUS_OK;
+			send(&frame, sizeof(*reply), &rx_addr);
+			break;
+		}
+
+		case Protocol::OP_CHECKSUM_PAGES:
+		{
+			uint32_t addr = frame.request.header.address;
+			uint32_t pages = frame.request.header.length;
+			log("Checksum %u pages from 0x%06X ", pages, addr);
+			if ((addr % ERASE_SIZE) || (addr >= _flash->size())) {
+				frame.reply.header.status = Protocol::STATUS_INV_ADDR;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			if (!pages || (pages * sizeof(Protocol::be32_t) > MAX_REPLY - sizeof(frame.reply.header)) ||
+				(addr + pages * ERASE_SIZE > _flash->size())) {
+				frame.reply.header.status = Protocol::STATUS_INV_LENGTH;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			acknowledge(&frame, CHECKSUM_PAGE_TIME_US * pages, &rx_addr);
+			delay(_timing.checksum_page_us * pages);
+			auto reply = reinterpret_cast<Protocol::ChecksumPagesReply*>(frame.reply.payload);
+			for (uint32_t i = 0; i < pages; i++, addr += ERASE_SIZE) {
+				std::array<std::byte, ERASE_SIZE> page;
+				_flash->read(addr, page);
+				reply->checksum[i] = Protocol::checksum(page);
+			}
+			frame.reply.header.status = Protocol::STATUS_OK;
+			send(&frame, pages * sizeof(Protocol::be32_t), &rx_addr);
+			break;
+		}
+
+		case Protocol::OP_BLANK_CHECK:
+		{
+			uint32_t addr = frame.request.header.address;
+			uint32_t pages = frame.request.header.length;
+			const uint32_t size = (pages + 7) / 8;
+			log("Blank check %u pages from 0x%06X ", pages, addr);
+			if ((addr % ERASE_SIZE) || (addr >= _flash->size())) {
+				frame.reply.header.status = Protocol::STATUS_INV_ADDR;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			if (!pages || (size > MAX_REPLY - sizeof(frame.reply.header)) || (addr + pages * ERASE_SIZE > _flash->size())) {
+				frame.reply.header.status = Protocol::STATUS_INV_LENGTH;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			acknowledge(&frame, CHECKSUM_PAGE_TIME_US * pages, &rx_addr);
+			delay(_timing.checksum_page_us * pages);
+			memset(frame.reply.payload, 0, size);
+			for (uint32_t i = 0; i < pages; i++, addr += ERASE_SIZE)
+				if (_flash->is_blank(addr, ERASE_SIZE))
+					frame.reply.payload[i / 8] |= 1 << (i % 8);
+			frame.reply.header.status = Protocol::STATUS_OK;
+			send(&frame, size, &rx_addr);
+			break;
+		}
+
+		case Protocol::OP_STREAM_STATUS:
+		{
+			const uint32_t addr = frame.request.header.address;
+			const uint32_t pages = frame.request.header.length;
+			const uint32_t size = (pages + 7) / 8;
+			const uint16_t session = frame.request.stream_status.session;
+			auto reply = reinterpret_cast<Protocol::StreamStatusReply*>(frame.reply.payload);
+			log("Stream status %u pages from 0x%06X, session %u ", pages, addr, session);
+			if (!(_capabilities & Protocol::CAP_STREAM)) {
+				frame.reply.header.status = Protocol::STATUS_INV_OP;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			if (len < sizeof(frame.request.header) + sizeof(frame.request.stream_status)) {
+				frame.reply.header.status = Protocol::STATUS_PKT_SIZE;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			if ((addr % ERASE_SIZE) || (addr >= _flash->size())) {
+				frame.reply.header.status = Protocol::STATUS_INV_ADDR;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			if (!pages || (sizeof(reply->session) + size > MAX_REPLY - sizeof(frame.reply.header)) ||
+				(addr + pages * ERASE_SIZE > _flash->size())) {
+				frame.reply.header.status = Protocol::STATUS_INV_LENGTH;
+				send(&frame, 0, &rx_addr);
+				return;
+			}
+
+			reply->session = _stream_session;
+			memset(reply->bitmap, 0, size);
+			if (session == _stream_session)
+				for (uint32_t i = 0; i < pages; i++)
+					if (_stream_sectors[addr / ERASE_SIZE + i] == (1 << SECTORS_PER_PAGE) - 1)
+						reply->bitmap[i / 8] |= 1 << (i % 8);
+			frame.reply.header.status = Protocol::STATUS_OK;
+			send(&frame, sizeof(reply->session) + size, &rx_addr);
+			break;
+		}
+
+		default:
+			log("Unsupported operation!");
+			frame.reply.header.status = Protocol::STATUS_INV_OP;
+			send(&frame, 0, &rx_addr);
+	}
+
+	log("\n");
+}
+
+TargetGroup::TargetGroup(size_t count, uint16_t dev_id, size_t flash_size, uint16_t base_port,
+						 uint32_t group_address, uint16_t group_port)
+{
+	for (size_t i = 0; i < count; i++) {
+		auto target = std::make_unique<Target>(dev_id, flash_size, static_cast<uint16_t>(base_port + i));
+		target->join_group(group_address, group_port);
+		_targets.push_back(std::move(target));
+	}
+}
+
+// Make all targets factory-fresh boards with consecutive MAC addresses starting at base_mac
+void TargetGroup::set_unconfigured(const MacAddress& base_mac) {
+	for (size_t i = 0; i < _targets.size(); i++) {
+		MacAddress mac = base_mac;
+		mac[5] = static_cast<uint8_t>(mac[5] + i);
+		_targets[i]->set_unconfigured(mac);
+	}
+}
+
+// Run all targets, blocks like Target::start()
+void TargetGroup::start() {
+	std::vector<std::thread> threads;
+
+	for (auto& target : _targets)
+		threads.emplace_back(&Target::start, target.get());
+
+	for (auto& thread : threads)
+		thread.join();
+}
+
+TargetFleet::TargetFleet(size_t count, std::span<const uint16_t> dev_ids, uint16_t base_port,
+						 uint32_t base_address, size_t workers)
+	: _rx_frames(workers ? workers : std::max<size_t>(std::thread::hardware_concurrency(), 1)), _running(false)
+{
+	if (dev_ids.empty())
+		throw Exception("No device for the simulated boards.");
+
+	const bool aliases = (base_address != INADDR_ANY);
+	if (!aliases && (count > 65536u - base_port))
+		throw Exception("Too many boards for the port range.");
+
+	_targets.reserve(count);
+	for (size_t i = 0; i < count; i++) {
+		const uint16_t dev_id = dev_ids[i % dev_ids.size()];
+		const size_t flash_size = DeviceDescriptor::find(dev_id)->flash_size;
+		const uint16_t port = aliases ? base_port : static_cast<uint16_t>(base_port + i);
+		const uint32_t address = aliases ? Network::htonl()(Network::ntohl()(base_address) + static_cast<uint32_t>(i)) : INADDR_ANY;
+
+		auto target = std::make_unique<Target>(dev_id, flash_size, port, address);
+		target->set_verbose(false);
+		target->open(true);
+		_targets.push_back(std::move(target));
+	}
+}
+
+// Model operation durations of all boards, each one with its own jitter sequence
+void TargetFleet::set_timing(const Target::Timing& timing, uint32_t seed) {
+	for (size_t i = 0; i < _targets.size(); i++)
+		_targets[i]->set_timing(timing, seed + static_cast<uint32_t>(i));
+}
+
+// Keep flash of each board in its own sparse file in the directory
+void TargetFleet::map_flash(const std::filesystem::path& directory) {
+	std::filesystem::create_directories(directory);
+	for (size_t i = 0; i < _targets.size(); i++)
+		_targets[i]->map_flash(directory / std::format("board-{}.flash", i));
+}
+
+// Set flash of boards with the snapshot's flash size to it, only while the fleet isn't running
+size_t TargetFleet::restore_flash(const std::filesystem::path& snapshot) {
+	const auto shared = std::make_shared<const FlashSnapshot>(snapshot);
+	size_t restored = 0;
+
+	for (auto& target : _targets)
+		if (target->get_flash_size() == shared->size()) {
+			target->restore_flash(shared);
+			restored++;
+		}
+
+	return restored;
+}
+
+// Requests handled by all boards
+uint64_t TargetFleet::get_rx_frames() const {
+	uint64_t frames = 0;
+	for (const auto& counter : _rx_frames)
+		frames += counter.load(std::memory_order_relaxed);
+	return frames;
+}
+
+// Statistics summed over all boards, only while the fleet isn't running
+Target::Statistics TargetFleet::get_statistics() const {
+	Target::Statistics total{};
+	for (const auto& target : _targets) {
+		const Target::Statistics& stats = target->get_statistics();
+		total.rx_frames += stats.rx_frames;
+		total.tx_frames += stats.tx_frames;
+		total.tx_dropped += stats.tx_dropped;
+		total.erases += stats.erases;
+		total.writes += stats.writes;
 	}
+	return total;
+}
+
+// Most erases of a single page of any board
+uint32_t TargetFleet::get_max_erase_count() const {
+	uint32_t count = 0;
+	for (const auto& target : _targets)
+		for (uint32_t erases : target->get_erase_counts())
+			count = std::max(count, erases);
+	return count;
+}
+
+void TargetFleet::serve(size_t worker) {
+	const size_t workers = _rx_frames.size();
+	std::vector<Target*> targets;
+	std::vector<pollfd> fds;
+
+	// Every worker takes each n-th board
+	for (size_t i = worker; i < _targets.size(); i += workers) {
+		targets.push_back(_targets[i].get());
+		fds.push_back({ targets.back()->get_socket(), POLLRDNORM, 0 });
+	}
+
+	if (fds.empty())
+		return;
+
+	auto next = std::chrono::steady_clock::time_point::max();
+	while (_running) {
+		// Wake up when a delayed reply of a board is due
+		Network::poll(fds, next, Network::POLL_INTERVAL_MS);
+
+		size_t frames = 0;
+		next = std::chrono::steady_clock::time_point::max();
+		for (size_t i = 0; i < fds.size(); i++) {
+			if (fds[i].revents & POLLRDNORM)
+				frames += targets[i]->service(targets[i]->get_socket());
+			next = std::min(next, targets[i]->send_replies());
+		}
+
+		_rx_frames[worker].fetch_add(frames, std::memory_order_relaxed);
+	}
+}
+
+// Run all boards, reporting the throughput every second if requested. Blocks until stop().
+void TargetFleet::start(bool report) {
+	std::vector<std::thread> threads;
+
+	_running = true;
+	if (!report) {
+		for (size_t i = 1; i < _rx_frames.size(); i++)
+			threads.emplace_back(&TargetFleet::serve, this, i);
+		serve(0);
+
+		for (auto& thread : threads)
+			thread.join();
+		return;
+	}
+
+	for (size_t i = 0; i < _rx_frames.size(); i++)
+		threads.emplace_back(&TargetFleet::serve, this, i);
+
+	printf("Simulating %zu boards on %zu workers\n", _targets.size(), _rx_frames.size());
+
+	uint64_t last = get_rx_frames();
+	auto last_time = std::chrono::steady_clock::now();
+	while (_running) {
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+
+		const uint64_t frames = get_rx_frames();
+		const auto now = std::chrono::steady_clock::now();
+		const double seconds = std::chrono::duration<double>(now - last_time).count();
+		printf("%.0f packets/s, %llu total\n", (frames - last) / seconds, static_cast<unsigned long long>(frames));
+		last = frames;
+		last_time = now;
+	}
+
+	for (auto& thread : threads)
+		thread.join();
 }
 
 } // namespace programmer
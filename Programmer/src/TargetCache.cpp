@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Copyright(c) 2023 Koko Software. All rights reserved.
+//
+// Author: Adrian Warecki <embedded@kokosoftware.pl>
+
+#include <stdio.h>
+#include <string>
+#include <cstring>
+#include <optional>
+#include <fstream>
+#include <algorithm>
+
+#include <Windows.h>
+#include <iphlpapi.h>
+
+#include <Programmer/TargetCache.hpp>
+
+namespace programmer {
+
+/* One target per line:
+ * <ip> <port> <mac> <device id> <bootloader version> <bootloader address> <rtt in us>
+ */
+TargetCache::TargetCache(const std::filesystem::path& path)
+	: _path(path), _dirty(false)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+		return;
+
+	std::string line;
+	while (std::getline(file, line)) {
+		char ip[INET_ADDRSTRLEN] = {};
+		char mac[18] = {};
+		unsigned port, device_id, version, address;
+		long long rtt;
+
+		if (sscanf(line.c_str(), "%15s %u %17s %x %x %x %lld", ip, &port, mac, &device_id, &version, &address, &rtt) != 7)
+			continue;
+
+		Entry entry{};
+		if (inet_pton(AF_INET, ip, &entry.ip_address) != 1 || !Network::parse_mac(mac, entry.mac))
+			continue;
+
+		entry.port = static_cast<uint16_t>(port);
+		entry.bootloader.device_id = static_cast<uint16_t>(device_id);
+		entry.bootloader.version = static_cast<uint16_t>(version);
+		entry.bootloader.address = address;
+		entry.rtt = std::chrono::microseconds(rtt);
+		_entries.push_back(entry);
+	}
+}
+
+const TargetCache::Entry* TargetCache::find(uint32_t ip_address) const {
+	auto it = std::find_if(_entries.begin(), _entries.end(), [ip_address](const Entry& entry) {
+		return entry.ip_address == ip_address;
+	});
+	return (it != _entries.end()) ? &*it : nullptr;
+}
+
+const TargetCache::Entry* TargetCache::find(const MacAddress& mac) const {
+	if (mac == MacAddress{})
+		return nullptr;
+
+	auto it = std::find_if(_entries.begin(), _entries.end(), [&mac](const Entry& entry) {
+		return entry.mac == mac;
+	});
+	return (it != _entries.end()) ? &*it : nullptr;
+}
+
+void TargetCache::store(const Entry& entry) {
+	// A MAC moved to another address
+	if (entry.mac != MacAddress{})
+		std::erase_if(_entries, [&entry](const Entry& e) { return e.mac == entry.mac; });
+
+	invalidate(entry.ip_address);
+	_entries.push_back(entry);
+	_dirty = true;
+}
+
+void TargetCache::invalidate(uint32_t ip_address) {
+	if (std::erase_if(_entries, [ip_address](const Entry& entry) { return entry.ip_address == ip_address; }))
+		_dirty = true;
+}
+
+// Write the cache back if it was changed
+void TargetCache::save() {
+	if (!_dirty)
+		return;
+
+	std::ofstream file(_path, std::ios::trunc);
+	if (!file.is_open())
+		throw Exception("Unable to write the target cache.");
+
+	for (const Entry& entry : _entries) {
+		char ip[INET_ADDRSTRLEN] = {};
+		char line[128];
+		inet_ntop(AF_INET, &entry.ip_address, ip, sizeof(ip));
+
+		snprintf(line, sizeof(line), "%s %u %02X:%02X:%02X:%02X:%02X:%02X %04X %04X %06X %lld\n", ip, entry.port,
+				 entry.mac[0], entry.mac[1], entry.mac[2], entry.mac[3], entry.mac[4], entry.mac[5],
+				 entry.bootloader.device_id, entry.bootloader.version, entry.bootloader.address,
+				 static_cast<long long>(entry.rtt.count()));
+		file << line;
+	}
+
+	_dirty = false;
+}
+
+// Store the target the programmer is connected to
+void TargetCache::learn(const NetworkProgrammer& programmer, uint32_t ip_address, uint16_t port, const Entry* cached) {
+	const auto& bootloader = programmer.get_bootloader_info();
+	Entry entry{ ip_address, port, {}, bootloader,
+				 std::chrono::duration_cast<std::chrono::microseconds>(programmer.get_rtt()) };
+
+	// Identical boards answer the discover the same way, only the MAC tells them apart
+	entry.mac = resolve(ip_address);
+
+	if (!entry.rtt.count() && cached)
+		entry.rtt = cached->rtt;
+
+	store(entry);
+}
+
+// Connect to a target at the address, validating and updating its entry
+void TargetCache::connect(NetworkProgrammer& programmer, uint32_t ip_address, uint16_t port) {
+	const Entry* cached = find(ip_address);
+	if (cached && (cached->port == port) && cached->rtt.count())
+		programmer.set_rtt(cached->rtt);
+
+	try {
+		programmer.connect_device(ip_address, port);
+	}
+	catch (...) {
+		invalidate(ip_address);
+		save();
+		throw;
+	}
+
+	// Copy, the entry is replaced by learn()
+	std::optional<Entry> previous;
+	if (cached)
+		previous = *cached;
+
+	learn(programmer, ip_address, port, previous ? &*previous : nullptr);
+	save();
+}
+
+// Connect to a target with the MAC address. Falls back to the discovery if the cached address doesn't lead to it.
+void TargetCache::connect(NetworkProgrammer& programmer, const MacAddress& mac, Discovery& discovery) {
+	if (const Entry* cached = find(mac)) {
+		const uint32_t ip_address = cached->ip_address;
+		try {
+			connect(programmer, ip_address, cached->port);
+			const Entry* entry = find(ip_address);
+			if (entry && (entry->mac == mac))
+				return;
+		}
+		catch (const std::exception& e) {
+			printf("Cached target failed validation: %s\n", e.what());
+		}
+
+		// Another board took the address
+		invalidate(ip_address);
+		save();
+	}
+
+	for (const DiscoveredTarget& target : discovery.discover()) {
+		if (resolve(target.address.sin_addr.s_addr) != mac)
+			continue;
+
+		connect(programmer, target.address.sin_addr.s_addr, Network::ntohs()(target.address.sin_port));
+		return;
+	}
+
+	throw Exception("Target {:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X} not found.",
+					mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+// Get MAC address of a target on a local network with ARP, zero if it doesn't respond
+MacAddress TargetCache::resolve(uint32_t ip_address) {
+	ULONG buffer[2] = {};
+	ULONG size = sizeof(buffer);
+	MacAddress mac{};
+
+	if ((SendARP(ip_address, 0, buffer, &size) == NO_ERROR) && (size >= mac.size()))
+		std::memcpy(mac.data(), buffer, mac.size());
+
+	return mac;
+}
+
+} // namespace programmer
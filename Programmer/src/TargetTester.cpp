@@ -8,79 +8,58 @@
 #include <cassert>
 #include <cinttypes>
 #include <exception>
+#include <thread>
+#include <bit>
+#include <cmath>
 
 #include <Programmer/TargetTester.hpp>
+#include <Programmer/Payload.hpp>
 
 #include <stdio.h>
 
 namespace programmer {
 
-Timer::Timer(int64_t time) {
-	_handle = CreateWaitableTimer(nullptr, false, nullptr);
-	if (!_handle)
-		throw std::system_error(GetLastError(), std::system_category());
-
-	// in 100 nanoseconds intervals
-	LARGE_INTEGER due_time = { .QuadPart = time * -100 };
-	if (!SetWaitableTimer(_handle, &due_time, time, nullptr, nullptr, false))
-		throw std::system_error(GetLastError(), std::system_category());
-}
-
-Timer::~Timer() {
-	CloseHandle(_handle);
-}
-
-bool Timer::check() {
-	DWORD result = WaitForSingleObject(_handle, 0);
-	switch (result) {
-		case WAIT_OBJECT_0:
-			return true;
-		case WAIT_TIMEOUT:
-			return false;
-		case WAIT_ABANDONED:
-		case WAIT_FAILED:
-		default:
-			throw std::system_error(GetLastError(), std::system_category());
-	}
-}
-
-TargetNetworkTester::TargetNetworkTester(uint32_t address)
-	: _poll{ { _socket, POLLIN} }, _timeout(false), _stats{0}, _stats_timer(1000*10)
+TargetNetworkTester::TargetNetworkTester(uint32_t address, const Config& config)
+	: _config(config), _pacer(INITIAL_RATE, MIN_RATE, config.max_rate, config.window * MAX_RX_FRAME),
+	_running(false), _report(false), _key((static_cast<uint64_t>(std::random_device()()) << 32) | std::random_device()()),
+	_seq(0), _last_response{}, _timeout(false)
 {
-	std::random_device dev;
-
-	_rand_eng.seed(dev());
+	if (!config.window || (config.window > RING_SIZE))
+		throw Exception("Window of {} frames is out of range 1-{}.", config.window, RING_SIZE);
+	if ((config.payload_size < RANDOM_PAYLOAD) || (config.payload_size > MAX_PAYLOAD))
+		throw Exception("Payload of {} bytes is out of range 0-{}.", config.payload_size, MAX_PAYLOAD);
 
 	_tx_address.sin_family = AF_INET;
 	_tx_address.sin_addr.s_addr = address;
-	_tx_address.sin_port = Network::htons()(666);
+	_tx_address.sin_port = Network::htons()(config.port);
 
 	if (address == INADDR_BROADCAST)
 		_socket.set_broadcast(true);
+	_socket.setsockopt(SOL_SOCKET, SO_RCVBUF, &SOCKET_BUFFER_SIZE, sizeof(SOCKET_BUFFER_SIZE));
+	_socket.setsockopt(SOL_SOCKET, SO_SNDBUF, &SOCKET_BUFFER_SIZE, sizeof(SOCKET_BUFFER_SIZE));
 	_socket.set_nonblocking(true);
-	_seq = 0;
 }
 
 void TargetNetworkTester::check_ESTAT(uint8_t ESTAT) {
-	if (ESTAT & ESTAT_TXABRT_MASK) printf("ESTAT: Transmit Abort Error\n");
-	if (ESTAT & ESTAT_BUFER_MASK) printf("ESTAT: Ethernet Buffer Error\n");
-	//if (ESTAT & ESTAT_RXBUSY_MASK) printf("ESTAT: Receive Busy\n");
-	if (ESTAT & ESTAT_RESERVED_MASK) printf("ESTAT: Reserved\n");
-	if (!(ESTAT & ESTAT_PHYRDY_MASK)) printf("ESTAT: Ethernet PHY Clock NOT Ready\n");
+	if (ESTAT & ESTAT_TXABRT_MASK) event("ESTAT: Transmit Abort Error\n");
+	if (ESTAT & ESTAT_BUFER_MASK) event("ESTAT: Ethernet Buffer Error\n");
+	//if (ESTAT & ESTAT_RXBUSY_MASK) event("ESTAT: Receive Busy\n");
+	if (ESTAT & ESTAT_RESERVED_MASK) event("ESTAT: Reserved\n");
+	if (!(ESTAT & ESTAT_PHYRDY_MASK)) event("ESTAT: Ethernet PHY Clock NOT Ready\n");
 }
 
 void TargetNetworkTester::check_RCON(uint8_t RCON) {
-	if (!(RCON & RCON_nBOR_MASK)) printf("RCON: Brown-out Reset\n");
-	if (!(RCON & RCON_nPOR_MASK)) printf("RCON: Power-on Reset\n");
-	if (!(RCON & RCON_nPD_MASK)) printf("RCON: Power-Down Detection\n");
-	if (!(RCON & RCON_nTO_MASK)) printf("RCON: Watchdog Timer Time-out\n");
-	if (!(RCON & RCON_nRI_MASK)) printf("RCON: RESET Instruction\n");
-	if (!(RCON & RCON_nCM_MASK)) printf("RCON: Configuration Mismatch\n");
+	if (!(RCON & RCON_nBOR_MASK)) event("RCON: Brown-out Reset\n");
+	if (!(RCON & RCON_nPOR_MASK)) event("RCON: Power-on Reset\n");
+	if (!(RCON & RCON_nPD_MASK)) event("RCON: Power-Down Detection\n");
+	if (!(RCON & RCON_nTO_MASK)) event("RCON: Watchdog Timer Time-out\n");
+	if (!(RCON & RCON_nRI_MASK)) event("RCON: RESET Instruction\n");
+	if (!(RCON & RCON_nCM_MASK)) event("RCON: Configuration Mismatch\n");
 }
 
 void TargetNetworkTester::check_STKPTR(uint8_t STKPTR) {
-	if (STKPTR & STKPTR_STKUNF_MASK) printf("STKPTR: Stack Underflow\n");
-	if (STKPTR & STKPTR_STKFUL_MASK) printf("STKPTR: Stack Full\n");
+	if (STKPTR & STKPTR_STKUNF_MASK) event("STKPTR: Stack Underflow\n");
+	if (STKPTR & STKPTR_STKFUL_MASK) event("STKPTR: Stack Full\n");
 }
 
 bool TargetNetworkTester::received(const void* response, int len) {
@@ -92,76 +71,95 @@ bool TargetNetworkTester::received(const void* response, int len) {
 
 	bool print = _timeout;
 
-	_stats.rx++;
-	_stats.rx_total_bytes += len + NET_HEADERS_SIZE;
+	_rx_stats.rx++;
+	_rx_stats.rx_total_bytes += len + NET_HEADERS_SIZE;
 
 	if (len < sizeof(Response)) {
-		printf("Response too short.\n");
+		event("Response too short.\n");
 		return false;
 	}
 
-	Frame& const request = _queue.front();
-	if (rx_buf->resp.cur_seq != request.seq) {
-		printf("Seq mismatch.\n");
-		_stats.seq_mismatch++;
+	// Responses to frames no longer in flight, e.g. late ones after a timeout, are ignored
+	Frame* request = _ring.front();
+	const size_t ahead = request ? ((rx_buf->resp.cur_seq - request->seq) & SEQ_MASK) : 0;
+	if (!request || (ahead >= _ring.size())) {
+		_rx_stats.unexpected++;
+		return false;
+	}
+
+	if (ahead) {
+		event("Seq mismatch.\n");
+		_rx_stats.seq_mismatch++;
 		print = true;
-#if 1
-		// TODO: Generalnie to to wybucha gdy przypadkiem zostawisz wgrany firmware, ktry w ptli wysya jedn odpowied
-		// Robimy w ptli pop, a wyczycimy queue i jest problem. Tylko teraz jest 01:40 i nie mam siy
-		// Wymyla rozwizania na to. Popraw to prosz!
-		while (rx_buf->resp.cur_seq != request.seq) {
-			if ((rx_buf->resp.last_seq + 1) == rx_buf->resp.cur_seq)
-				_stats.lost_tx++;
-			else
-				_stats.lost_rx++;
 
-			_queue.pop();
-			request = _queue.front();
+		// Target received the previous request, so responses were lost
+		const bool lost_tx = (rx_buf->resp.last_seq + 1) == rx_buf->resp.cur_seq;
+		std::lock_guard lock(_pacer_lock);
+		for (size_t i = 0; i < ahead; i++) {
+			if (lost_tx)
+				_rx_stats.lost_tx++;
+			else
+				_rx_stats.lost_rx++;
+			_pacer.lost();
+			_ring.pop();
 		}
-#endif
+		request = _ring.front();
 	}
+
 	int payload_size = len - sizeof(Response);
-	if (payload_size == request.payload_size) {
-		if (std::memcmp(request.payload, rx_buf->payload, payload_size)) {
-			_stats.payload_invalid++;
-			printf("Invalid payload\n");
+	if (payload_size == request->payload_size) {
+		if (TestPayload::verify(_key, request->seq,
+								std::span(reinterpret_cast<const std::byte*>(rx_buf->payload), payload_size)))
+			_rx_stats.payload_bytes += payload_size;
+		else {
+			_rx_stats.payload_invalid++;
+			event("Invalid payload\n");
 		}
 	} else {
-		_stats.payload_size++;
-		printf("Payload size mismatch. Received: %d, expected: %d\n", payload_size, request.payload_size);
+		_rx_stats.payload_size++;
+		event("Payload size mismatch. Received: %d, expected: %d\n", payload_size, request->payload_size);
 	}
 
 	if (rx_buf->resp.boot_counter < _last_response.boot_counter) {
 		print = true;
-		printf("Boot counter decremented.\n");
+		event("Boot counter decremented.\n");
 	}
 
 	if (rx_buf->resp.received_arp < _last_response.received_arp) {
 		print = true;
-		printf("Received ARP decremented.\n");
+		event("Received ARP decremented.\n");
 	}
 
 	if (rx_buf->resp.received_udp < _last_response.received_udp) {
 		print = true;
-		printf("Received UDP decremented.\n");
+		event("Received UDP decremented.\n");
 	}
 
 	if (rx_buf->resp.boot_counter > _last_response.boot_counter) {
 		print = true;
-		printf("Reboot detected (%u).\n", rx_buf->resp.boot_counter);
+		event("Reboot detected (%u).\n", rx_buf->resp.boot_counter);
 	}
 
 	/*
 	if (rx_buf->resp.ERXRDPT < _last_response.ERXRDPT) {
 		print = true;
-		printf("Receive buffer wrap around %u -> %u\n", _last_response.ERXRDPT, rx_buf->resp.ERXRDPT);
+		event("Receive buffer wrap around %u -> %u\n", _last_response.ERXRDPT, rx_buf->resp.ERXRDPT);
 	}
 	*/
 
+	// Target reports frames waiting in its receive buffer
+	const auto rtt = std::chrono::steady_clock::now() - request->sent;
+	{
+		std::lock_guard lock(_pacer_lock);
+		_pacer.delivered(rtt);
+		_pacer.occupancy(rx_buf->resp.EPKTCNT * MAX_RX_FRAME);
+	}
+	_rx_stats.latency[latency_bucket(std::chrono::duration_cast<std::chrono::microseconds>(rtt).count())]++;
+
 	std::memcpy(&_last_response, &rx_buf->resp, sizeof(_last_response));
-	if (request.command & COMMAND_CLEAR) {
+	if (request->command & COMMAND_CLEAR) {
 		print = true;
-		printf("Statistics cleared.\n");
+		event("Statistics cleared.\n");
 		_last_response.boot_counter = 0;
 		_last_response.received_arp = 0;
 		_last_response.received_udp = 0;
@@ -172,49 +170,30 @@ bool TargetNetworkTester::received(const void* response, int len) {
 		check_RCON(rx_buf->resp.RCON);
 	check_STKPTR(rx_buf->resp.STKPTR);
 
-	if (print || _stats_timer.check()) {
-	//if (print) {
-		printf("Tx: len = %u, seq = %u. ", request.payload_size, request.seq);
-		printf("Rx: last seq: %u, seq: %u, boot: %u, arp: %u, udp: %u, Read: 0x%04X, Write: 0x%04X, EPKTCNT: %u\n",
+	// Details of a response are printed after an event or on request of the report
+	if (print || (_report.load(std::memory_order_relaxed) && _report.exchange(false))) {
+		event("Tx: len = %u, seq = %u. ", request->payload_size, request->seq);
+		event("Rx: last seq: %u, seq: %u, boot: %u, arp: %u, udp: %u, Read: 0x%04X, Write: 0x%04X, EPKTCNT: %u\n",
 			rx_buf->resp.last_seq, rx_buf->resp.cur_seq, rx_buf->resp.boot_counter, rx_buf->resp.received_arp,
 			rx_buf->resp.received_udp, rx_buf->resp.ERXRDPT, rx_buf->resp.ERXWRPT, rx_buf->resp.EPKTCNT);
-	//}
-		printf("Stats: Tx: %u, Rx: %u, lost rx: %u, lost tx: %u, timeout: %u, pld size: %u, pld inv: %u, seq inv: %u\n", _stats.tx, _stats.rx, _stats.lost_rx,
-			   _stats.lost_tx, _stats.timeout, _stats.payload_size, _stats.payload_invalid, _stats.seq_mismatch);
-
-#if 1
-		auto now = std::chrono::steady_clock::now();
-		//int elapsed = 1;
-		//int elapsed = std::chrono::duration_cast<std::chrono::duration<int, std::chrono::seconds>>(now - _stats.start_time).count();
-		auto delay = std::chrono::duration_cast<std::chrono::seconds>(now - _stats.start_time);
-		auto elapsed = delay.count();
-		if (elapsed) {
-			uint64_t upload = _stats.tx_total_bytes * 8 / elapsed;
-			uint64_t download = _stats.rx_total_bytes * 8 / elapsed;
-			printf("Transmitted: ");
-			print_size(_stats.tx_total_bytes);
-			printf("B (");
-			print_size(upload);
-			printf("b/s) Received: ");
-			print_size(_stats.rx_total_bytes);
-			printf("B (");
-			print_size(download);
-			printf("b/s)\n");
-		}
-#endif
 	}
+
 	_timeout = false;
 	if (!ENDLESS_TX)
-		_queue.pop();
+		_ring.pop();
 	return true;
 }
 
+// The oldest frame got no response, give up on it
 void TargetNetworkTester::timeout() {
 	_timeout = true;
-	_stats.timeout++;
-	const Frame& request = _queue.front();
-	printf("Receive timeout! Payload size: %u.\n", request.payload_size);
-	send();
+	_rx_stats.timeout++;
+	{
+		std::lock_guard lock(_pacer_lock);
+		_pacer.lost();
+	}
+	event("Receive timeout! Payload size: %u.\n", _ring.front()->payload_size);
+	_ring.pop();
 }
 
 void TargetNetworkTester::send(bool clear) {
@@ -224,21 +203,30 @@ void TargetNetworkTester::send(bool clear) {
 	} tx_buf;
 
 
-	int len = _rand_distr(_rand_eng) % MAX_PAYLOAD;
+	// Lengths come from other counters than the payload
+	int len = TestPayload::random(~_key, _seq) % MAX_PAYLOAD;
+	if (_config.payload_size != RANDOM_PAYLOAD)
+		len = _config.payload_size;
 	if (ENDLESS_TX || TX_THROUGHPUT_TEST)
 		len = MAX_PAYLOAD;
 
 	if (!CHECKSUM_BYTE_SUPPORT)
 		len &= ~1;
 
+	{
+		std::lock_guard lock(_pacer_lock);
+		_pacer.sent(len + sizeof(Request) + TARGET_HEADERS);
+	}
+
 	_seq++;
-	_seq &= 0x7FFFFFFF;
+	_seq &= SEQ_MASK;
 
-	Frame& frame = _queue.emplace();
+	// The window is smaller than the ring, so there is always a free slot
+	Frame& frame = *_ring.claim();
 	frame.command = 0;
 
 	if (clear) {
-		_seq |= 0x80000000;
+		_seq |= SEQ_CLEAR;
 		frame.command |= COMMAND_CLEAR;
 	}
 
@@ -246,78 +234,270 @@ void TargetNetworkTester::send(bool clear) {
 	frame.payload_size = len;
 
 	tx_buf.reg.seq = _seq;
-	prepare_payload(tx_buf.payload, frame);
-	_socket.sendto(std::span<std::byte>(reinterpret_cast<std::byte*>(&tx_buf),
-				   len + sizeof(Request)), 0, &_tx_address, sizeof(_tx_address));
+	TestPayload::generate(_key, _seq, std::span(reinterpret_cast<std::byte*>(tx_buf.payload), len));
 
-	_stats.tx++;
-	_stats.tx_total_bytes += len + sizeof(Request) + NET_HEADERS_SIZE;
+	// Published before sending, the response may come back before sendto returns
+	frame.sent = std::chrono::steady_clock::now();
+	_ring.publish();
+
+	const std::span<const std::byte> data(reinterpret_cast<const std::byte*>(&tx_buf), len + sizeof(Request));
+	for (;;) {
+		try {
+			_socket.sendto(data, 0, &_tx_address, sizeof(_tx_address));
+			break;
+		}
+		catch (const SocketException& e) {
+			if (e.code().value() != WSAEWOULDBLOCK)
+				throw;
+
+			// Socket buffer is full, wait for space
+			std::array<struct pollfd, 1> fds{ { { _socket, POLLOUT, 0 } } };
+			Network::poll(fds, Network::POLL_INTERVAL_MS);
+		}
+	}
+
+	_tx_stats.tx++;
+	_tx_stats.tx_total_bytes += len + sizeof(Request) + NET_HEADERS_SIZE;
 }
 
-void TargetNetworkTester::prepare_payload(uint8_t* tx_buf, Frame& frame) {
-	uint8_t* check_buf = frame.payload;
-	uint8_t mask = 0x5A;
-	int size = frame.payload_size;
-
-	assert(size <= sizeof(frame.payload));
-
-	while (size) {
-		auto rand = _rand_distr(_rand_eng);
-		for (int i = 0; (i < sizeof(rand)) && size; i++) {
-			uint8_t val = (uint8_t)rand;
-			*tx_buf++ = val;
-			mask ^= val;
-			*check_buf++ = mask;
-			rand >>= 8;
-			size--;
+// Send requests while the window and the pacer allow it
+void TargetNetworkTester::transmit() {
+	using std::chrono::steady_clock;
+	using std::chrono::milliseconds;
+
+	bool clear = true;
+	while (_running) {
+		_ring.wait_below(_config.window);
+		if (!_running)
+			break;
+
+		std::unique_lock lock(_pacer_lock);
+		if (!_pacer.ready()) {
+			const auto next = _pacer.next();
+			lock.unlock();
+
+			// Sleep is too coarse for short waits at high rates
+			if (next - steady_clock::now() > milliseconds(1))
+				std::this_thread::sleep_until(next);
+			else
+				std::this_thread::yield();
+			continue;
 		}
+
+		lock.unlock();
+
+		send(clear);
+		clear = false;
 	}
 }
 
-void TargetNetworkTester::test() {
+// Receive and verify responses, drop frames without one
+void TargetNetworkTester::receive() {
 	using std::chrono::steady_clock;
 	using std::chrono::milliseconds;
-	using std::chrono::duration_cast;
-	using std::chrono::duration;
 
-	int rx_address_size;
+	std::array<struct pollfd, 1> fds{ { { _socket, POLLIN, 0 } } };
 	std::byte buf[BUFFER_SIZE];
+	auto progress = steady_clock::now();
+
+	while (_running) {
+		auto wake = steady_clock::time_point::max();
+		if (const Frame* front = _ring.front()) {
+			const auto deadline = std::max(front->sent, progress) + milliseconds(TIMEOUT);
+			const auto now = steady_clock::now();
+			if (deadline <= now) {
+				timeout();
+				progress = now;
+				continue;
+			}
+
+			wake = deadline;
+		}
+
+		Network::poll(fds, wake, Network::POLL_INTERVAL_MS);
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		for (;;) {
+			int rx_address_size = sizeof(_rx_address);
+			const int size = _socket.recvfrom(buf, 0, &_rx_address, &rx_address_size);
+			if (size < 0)
+				break;
+
+			if (received(buf, size))
+				progress = steady_clock::now();
+		}
+	}
+}
 
-	_stats.start_time = steady_clock::now();
-
-	send(true);
-	int imax = 0;
-	while (1) {
-		while (_queue.size() < QUEUE_FILL_LEVEL)
-			send(false);
-
-		auto now = steady_clock::now();
-		auto deadline = now + milliseconds(TIMEOUT);
-		for (; deadline > now; now = steady_clock::now()) {
-			int timeout = duration_cast<duration<int, std::milli>>(deadline - now).count();
-			int ret = Network::poll(_poll, timeout);
-
-			if (ret && (_poll[0].revents & POLLIN)) {
-				rx_address_size = sizeof(_rx_address);
-				int i = 0;
-				for (;;) {
-					const int size = _socket.recvfrom(buf, 0, &_rx_address, &rx_address_size);
-					if (size < 0)
-						break;
-					i++;
-
-					if (received(buf, size)) {
-						while (_queue.size() < QUEUE_FILL_LEVEL)
-							send(false);
-						deadline = steady_clock::now() + milliseconds(TIMEOUT);
-					}
-				}
-				if (i > imax) imax = i;
+void TargetNetworkTester::report() {
+	printf("Stats: Tx: %" PRIu64 ", Rx: %" PRIu64 ", lost rx: %" PRIu64 ", lost tx: %" PRIu64 ", timeout: %" PRIu64
+		   ", pld size: %" PRIu64 ", pld inv: %" PRIu64 ", seq inv: %" PRIu64 ", unexpected: %" PRIu64 "\n",
+		   _tx_stats.tx.get(), _rx_stats.rx.get(), _rx_stats.lost_rx.get(), _rx_stats.lost_tx.get(),
+		   _rx_stats.timeout.get(), _rx_stats.payload_size.get(), _rx_stats.payload_invalid.get(),
+		   _rx_stats.seq_mismatch.get(), _rx_stats.unexpected.get());
+
+	auto now = std::chrono::steady_clock::now();
+	auto delay = std::chrono::duration_cast<std::chrono::seconds>(now - _start_time);
+	auto elapsed = delay.count();
+	if (elapsed) {
+		const uint64_t tx_total_bytes = _tx_stats.tx_total_bytes.get();
+		const uint64_t rx_total_bytes = _rx_stats.rx_total_bytes.get();
+		uint64_t upload = tx_total_bytes * 8 / elapsed;
+		uint64_t download = rx_total_bytes * 8 / elapsed;
+		printf("Transmitted: ");
+		print_size(tx_total_bytes);
+		printf("B (");
+		print_size(upload);
+		printf("b/s) Received: ");
+		print_size(rx_total_bytes);
+		printf("B (");
+		print_size(download);
+		printf("b/s)\n");
+	}
+}
+
+void TargetNetworkTester::run(const std::function<void()>& monitor) {
+	_start_time = std::chrono::steady_clock::now();
+	_error = nullptr;
+	_running = true;
+
+	// A failed thread stops the test and its exception is rethrown here
+	auto run = [this](void (TargetNetworkTester::*fun)()) {
+		try {
+			(this->*fun)();
+		}
+		catch (...) {
+			std::lock_guard lock(_stop_lock);
+			if (!_error)
+				_error = std::current_exception();
+			_running = false;
+			_stop.notify_all();
+		}
+	};
+
+	{
+		std::atomic<bool> transmitting = true;
+		std::jthread receiver([&] {
+			run(&TargetNetworkTester::receive);
+			// Release slots until the transmitter waiting for one stops
+			while (transmitting) {
+				_ring.clear();
+				std::this_thread::yield();
 			}
+		});
+		std::jthread transmitter([&] {
+			run(&TargetNetworkTester::transmit);
+			transmitting = false;
+		});
+
+		monitor();
+		stop();
+	}
+
+	if (_error)
+		std::rethrow_exception(_error);
+}
+
+bool TargetNetworkTester::wait_stop(std::chrono::milliseconds time) {
+	std::unique_lock lock(_stop_lock);
+	return _stop.wait_for(lock, time, [this] { return !_running; });
+}
+
+void TargetNetworkTester::test() {
+	run([this] {
+		while (!wait_stop(STATS_INTERVAL)) {
+			_report = true;
+			report();
 		}
-		printf("imax = %d\n", imax);
-		timeout();
+		report();
+	});
+}
+
+// Log-linear buckets, exact below LATENCY_SUB_BUCKETS
+size_t TargetNetworkTester::latency_bucket(uint64_t us) {
+	if (us < LATENCY_SUB_BUCKETS)
+		return us;
+
+	const int exponent = std::bit_width(us) - 1;
+	const size_t sub = (us >> (exponent - 4)) & (LATENCY_SUB_BUCKETS - 1);
+	return (exponent - 3) * LATENCY_SUB_BUCKETS + sub;
+}
+
+double TargetNetworkTester::bucket_latency(size_t bucket) {
+	if (bucket < LATENCY_SUB_BUCKETS)
+		return static_cast<double>(bucket);
+
+	const int shift = static_cast<int>(bucket / LATENCY_SUB_BUCKETS) - 1;
+	const double low = std::ldexp(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS, shift);
+	return low + std::ldexp(1, shift) / 2;
+}
+
+TargetNetworkTester::Snapshot TargetNetworkTester::snapshot() const {
+	Snapshot snap;
+	snap.time = std::chrono::steady_clock::now();
+	snap.tx = _tx_stats.tx.get();
+	snap.rx = _rx_stats.rx.get();
+	snap.lost = _rx_stats.lost_rx.get() + _rx_stats.lost_tx.get() + _rx_stats.timeout.get();
+	snap.errors = _rx_stats.payload_size.get() + _rx_stats.payload_invalid.get();
+	snap.payload_bytes = _rx_stats.payload_bytes.get();
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+		snap.latency[i] = _rx_stats.latency[i].get();
+	return snap;
+}
+
+TargetNetworkTester::Measurement TargetNetworkTester::measure(std::chrono::milliseconds warmup,
+															 std::chrono::milliseconds time) {
+	// Snapshots are large for the stack of the monitor
+	auto begin = std::make_unique<Snapshot>();
+	auto end = std::make_unique<Snapshot>();
+
+	// Stopping early shortens the measurement
+	run([&] {
+		wait_stop(warmup);
+		*begin = snapshot();
+		wait_stop(time);
+		*end = snapshot();
+	});
+
+	Measurement result{};
+	result.seconds = std::chrono::duration<double>(end->time - begin->time).count();
+	result.tx_frames = end->tx - begin->tx;
+	result.rx_frames = end->rx - begin->rx;
+	result.lost_frames = end->lost - begin->lost;
+	result.errors = end->errors - begin->errors;
+	if (result.seconds > 0)
+		result.goodput = (end->payload_bytes - begin->payload_bytes) / result.seconds;
+	if (result.tx_frames)
+		result.loss = static_cast<double>(result.lost_frames) / result.tx_frames;
+
+	uint64_t total = 0;
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+		end->latency[i] -= begin->latency[i];
+		total += end->latency[i];
 	}
+
+	// Smallest bucket covering each fraction of the responses
+	const std::pair<double, double*> percentiles[] = {
+		{ 0.5, &result.rtt_p50 }, { 0.9, &result.rtt_p90 }, { 0.99, &result.rtt_p99 }, { 0.999, &result.rtt_p999 }
+	};
+	uint64_t count = 0;
+	size_t bucket = 0;
+	for (const auto& [fraction, value] : percentiles) {
+		const uint64_t rank = static_cast<uint64_t>(std::ceil(fraction * total));
+		while ((bucket < LATENCY_BUCKETS) && (count + end->latency[bucket] < rank))
+			count += end->latency[bucket++];
+		if (total)
+			*value = bucket_latency(std::min(bucket, LATENCY_BUCKETS - 1));
+	}
+
+	return result;
+}
+
+void TargetNetworkTester::stop() {
+	std::lock_guard lock(_stop_lock);
+	_running = false;
+	_stop.notify_all();
 }
 
 void TargetNetworkTester::print_size(uint64_t value) {